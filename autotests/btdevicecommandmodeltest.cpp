@@ -0,0 +1,179 @@
+/*
+ *   Copyright 2021 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#include "BTDevice.h"
+#include "BTDeviceCommandModel.h"
+#include "BTDeviceModel.h"
+#include "TailCommandModel.h"
+
+#include <QSignalSpy>
+#include <QTest>
+
+namespace {
+    const int commandCount{40};
+
+    // A device which is always connected, and does nothing with the commands sent to it,
+    // so all the work done is in the models. It is named FAKE, so the device model accepts it.
+    class BenchmarkDevice : public BTDevice
+    {
+    public:
+        BenchmarkDevice(const QString& deviceID, BTDeviceModel* parent)
+            : BTDevice(QBluetoothDeviceInfo(QBluetoothAddress(deviceID), QString("FAKE"), 0), parent)
+            , id(deviceID)
+        {}
+        bool isConnected() const override { return true; }
+        QString version() const override { return QString("Benchmark"); }
+        QString currentCall() const override { return QString(); }
+        int batteryLevel() const override { return 4; }
+        void connectDevice() override {}
+        void disconnectDevice() override {}
+        QString deviceID() const override { return id; }
+        void sendMessage(const QString& /*message*/) override {}
+    private:
+        QString id;
+    };
+}
+
+class BTDeviceCommandModelTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void updateCost_data()
+    {
+        QTest::addColumn<int>("deviceCount");
+        QTest::addColumn<int>("groupCount");
+        // Each command in their own group, so starting one does not change the availability of
+        // any others, and then a few groups spread out through the model (like the commands on
+        // the devices are), so starting one changes the availability of several rows apart
+        for (int groupCount : {commandCount, 5}) {
+            for (int deviceCount : {1, 4, 16, 64}) {
+                QTest::newRow(qPrintable(QString("%1 devices, %2 groups").arg(deviceCount).arg(groupCount))) << deviceCount << groupCount;
+            }
+        }
+    }
+
+    // Starting and stopping a command on one device should only have the aggregated model look
+    // at the rows of that one device which changed, so the time taken per update should stay
+    // the same as the number of devices grows (and only depend on the size of the group)
+    void updateCost()
+    {
+        QFETCH(int, deviceCount);
+        QFETCH(int, groupCount);
+
+        CommandInfoList commands;
+        for (int i = 0; i < commandCount; ++i) {
+            CommandInfo command;
+            command.name = QString("Benchmark %1").arg(i);
+            command.command = QString("BENCH%1").arg(i);
+            command.category = QString("benchmark");
+            command.duration = 1000;
+            command.group = i % groupCount + 1;
+            commands << command;
+        }
+
+        BTDeviceModel deviceModel;
+        BTDeviceCommandModel commandModel;
+        commandModel.setDeviceModel(&deviceModel);
+        QVector<BTDevice*> devices;
+        for (int i = 0; i < deviceCount; ++i) {
+            BTDevice* device = new BenchmarkDevice(QString("00:11:22:33:%1:%2").arg(i / 256, 2, 16, QChar('0')).arg(i % 256, 2, 16, QChar('0')).toUpper(), &deviceModel);
+            deviceModel.addDevice(device);
+            device->commandModel->addCommands(commands);
+            devices << device;
+        }
+        QCOMPARE(deviceModel.rowCount(), deviceCount);
+        QCOMPARE(commandModel.rowCount(), commandCount);
+
+        const QString commandName{commands.at(commandCount / 2).command};
+        const CommandInfo* aggregated = commandModel.findCommand(commandName);
+        QVERIFY(aggregated);
+        TailCommandModel* deviceCommands = devices.last()->commandModel;
+        const int commandId = deviceCommands->commandId(commandName);
+        QVERIFY(commandId > -1);
+
+        // Each update should result in exactly one change in the aggregated model, however many devices
+        // there are, except with only the one device, where the rest of the group stops being available
+        const int expectedChanges = (deviceCount == 1) ? commandCount / groupCount : 1;
+        // The device's own model tells about each of the changed rows apart, as they are spread out
+        QSignalSpy deviceDataChangedSpy(deviceCommands, &QAbstractItemModel::dataChanged);
+        QSignalSpy dataChangedSpy(&commandModel, &QAbstractItemModel::dataChanged);
+        deviceCommands->setRunning(commandId, true);
+        QCOMPARE(deviceDataChangedSpy.count(), commandCount / groupCount);
+        for (const QList<QVariant>& change : qAsConst(deviceDataChangedSpy)) {
+            QCOMPARE(change.at(0).toModelIndex(), change.at(1).toModelIndex());
+        }
+        QCOMPARE(dataChangedSpy.count(), expectedChanges);
+        QVERIFY(aggregated->isRunning);
+        deviceCommands->setRunning(commandId, false);
+        QCOMPARE(dataChangedSpy.count(), 2 * expectedChanges);
+        QVERIFY(!aggregated->isRunning);
+        dataChangedSpy.clear();
+
+        QBENCHMARK {
+            deviceCommands->setRunning(commandId, true);
+            deviceCommands->setRunning(commandId, false);
+        }
+        QVERIFY(!aggregated->isRunning);
+    }
+
+    // Every command should be as likely to be picked as any other, however many times its
+    // category is asked for, and whichever of the included categories it is in
+    void randomCommandIsUniform()
+    {
+        CommandInfoList commands;
+        const QVector<QPair<QString, QString>> definitions{
+            {QString("ONE"), QString("first")},
+            {QString("ONE"), QString("second")},
+            {QString("TWO"), QString("second")},
+            {QString("THREE"), QString("second")}
+        };
+        for (const QPair<QString, QString>& definition : definitions) {
+            CommandInfo command;
+            command.name = definition.first;
+            command.command = definition.first;
+            command.category = definition.second;
+            command.duration = 1000;
+            commands << command;
+        }
+
+        BTDeviceModel deviceModel;
+        BTDeviceCommandModel commandModel;
+        commandModel.setDeviceModel(&deviceModel);
+        BTDevice* device = new BenchmarkDevice(QString("00:11:22:33:44:55"), &deviceModel);
+        deviceModel.addDevice(device);
+        device->commandModel->addCommands(commands);
+        QCOMPARE(commandModel.rowCount(), commands.count());
+
+        const QStringList includedCategories{QString("first"), QString("first"), QString("second")};
+        const int picks{3000};
+        QHash<QString, int> counts;
+        for (int i = 0; i < picks; ++i) {
+            ++counts[commandModel.getRandomCommand(includedCategories).command];
+        }
+        QCOMPARE(counts.count(), 3);
+        // Each should come up about a thousand times, where counting each time a command turns
+        // up would have ONE picked three times in five, so this leaves plenty of room for chance
+        for (QHash<QString, int>::const_iterator it = counts.constBegin(); it != counts.constEnd(); ++it) {
+            QVERIFY2(it.value() > picks / 3 - 300 && it.value() < picks / 3 + 300,
+                     qPrintable(QString("%1 was picked %2 times out of %3").arg(it.key()).arg(it.value()).arg(picks)));
+        }
+    }
+};
+
+QTEST_GUILESS_MAIN(BTDeviceCommandModelTest)
+
+#include "btdevicecommandmodeltest.moc"
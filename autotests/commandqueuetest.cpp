@@ -0,0 +1,116 @@
+/*
+ *   Copyright 2021 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#include "AppSettings.h"
+#include "BTConnectionManager.h"
+#include "CommandQueue.h"
+
+#include <QStandardPaths>
+#include <QStringListModel>
+#include <QTest>
+
+namespace {
+    const QStringList devices{QLatin1String{"00:11:22:33:44:55"}};
+
+    CommandInfo makeCommand(const QString& command, int duration)
+    {
+        CommandInfo info;
+        info.name = command;
+        info.command = command;
+        info.category = QLatin1String{"test"};
+        info.duration = duration;
+        return info;
+    }
+
+    // The command of the entry at the given position in the queue. The queue is not an item
+    // model itself, and only looks at the row of the index, so any model will do for making one.
+    QString commandAt(const CommandQueue* queue, int row)
+    {
+        QStringList rows;
+        for (int i = 0; i <= row; ++i) {
+            rows << QString();
+        }
+        const QStringListModel model(rows);
+        return queue->data(model.index(row), CommandQueue::Command).toString();
+    }
+}
+
+// The device the commands are sent to is never actually there, so these only look at the
+// queue itself: what is launched when, and in which order the entries are kept
+class CommandQueueTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase()
+    {
+        QStandardPaths::setTestModeEnabled(true);
+    }
+
+    // Once a casual mode pause has been launched, a gesture pushed onto the (now empty)
+    // queue should go straight away, rather than wait for the pause to end
+    void gestureGoesPastLaunchedPause()
+    {
+        AppSettings settings;
+        BTConnectionManager manager(&settings);
+        CommandQueue* queue = qobject_cast<CommandQueue*>(manager.commandQueue());
+        QVERIFY(queue);
+
+        queue->pushPause(30000, devices, CommandQueue::CasualPriority);
+        QCOMPARE(queue->count(), 0);
+
+        queue->pushCommands(CommandInfoList{makeCommand(QLatin1String{"GESTURE"}, 1000)}, devices, CommandQueue::GesturePriority);
+        QCOMPARE(queue->count(CommandQueue::GesturePriority), 0);
+        QVERIFY2(queue->lastLateness() < 100, qPrintable(QString("The gesture was launched %1ms after its deadline").arg(queue->lastLateness())));
+
+        // ...while anything casual is still held up by the pause (and the gesture)
+        queue->pushCommands(CommandInfoList{makeCommand(QLatin1String{"CASUAL"}, 1000)}, devices, CommandQueue::CasualPriority);
+        QCOMPARE(queue->count(CommandQueue::CasualPriority), 1);
+    }
+
+    void swapKeepsPriorityOrder()
+    {
+        AppSettings settings;
+        BTConnectionManager manager(&settings);
+        CommandQueue* queue = qobject_cast<CommandQueue*>(manager.commandQueue());
+        QVERIFY(queue);
+
+        // The first one is launched, and keeps the device busy while the others wait
+        queue->pushCommands(CommandInfoList{makeCommand(QLatin1String{"FIRST"}, 10000)}, devices, CommandQueue::MoveListPriority);
+        queue->pushCommands(CommandInfoList{makeCommand(QLatin1String{"SECOND"}, 1000)}, devices, CommandQueue::MoveListPriority);
+        queue->pushCommands(CommandInfoList{makeCommand(QLatin1String{"CASUAL"}, 1000)}, devices, CommandQueue::CasualPriority);
+        QCOMPARE(queue->count(), 2);
+
+        // Moving the casual entry ahead of the move list entry is refused...
+        queue->swapEntries(0, 1);
+        QCOMPARE(commandAt(queue, 0), QLatin1String{"SECOND"});
+        QCOMPARE(commandAt(queue, 1), QLatin1String{"CASUAL"});
+
+        // ...so a new move list entry still goes in ahead of it
+        queue->pushCommands(CommandInfoList{makeCommand(QLatin1String{"THIRD"}, 1000)}, devices, CommandQueue::MoveListPriority);
+        QCOMPARE(commandAt(queue, 1), QLatin1String{"THIRD"});
+        QCOMPARE(commandAt(queue, 2), QLatin1String{"CASUAL"});
+
+        // Entries of the same priority can still be swapped
+        queue->swapEntries(0, 1);
+        QCOMPARE(commandAt(queue, 0), QLatin1String{"THIRD"});
+        QCOMPARE(commandAt(queue, 1), QLatin1String{"SECOND"});
+    }
+};
+
+QTEST_GUILESS_MAIN(CommandQueueTest)
+
+#include "commandqueuetest.moc"
@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+#
+#   Copyright 2021 Dan Leinir Turthra Jensen <admin@leinir.dk>
+#
+#   This program is free software; you can redistribute it and/or modify
+#   it under the terms of the GNU Library General Public License as
+#   published by the Free Software Foundation; either version 3, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU Library General Public License for more details
+#
+#   You should have received a copy of the GNU Library General Public License
+#   along with this program; if not, see <https://www.gnu.org/licenses/>
+
+# Generates the synthetic accelerometer traces in this directory, in the same format
+# as the ones recorded by the app (see AccelerometerTrace), labelled with the number
+# of steps in them. Each step is one cycle of vertical acceleration (with a harmonic
+# on top, and varying in length and strength from step to step), and the readings
+# arrive at roughly 30Hz, with some jitter, and noise on top of the signal.
+# As the detector looks for steps shaped much like these, they only check that it keeps
+# finding the steps it was made to find, not how well it does on actual walks. Actual
+# recordings go in ../recorded instead.
+
+import math
+import random
+
+RATE = 30
+GRAVITY = 9.8
+
+
+def trace(name, description, segments, seed):
+    rng = random.Random(seed)
+    lines = []
+    steps = 0
+    timestamp = 1000000
+    for kind, duration, cadence, strength in segments:
+        if kind == "gap":
+            # The sensor was not running for a while (for example while the app was in the background)
+            timestamp += int(duration * 1000000)
+            continue
+        end = timestamp + int(duration * 1000000)
+        phase = 0.0
+        period = 1.0 / cadence if cadence else 0
+        amplitude = strength
+        while timestamp < end:
+            if kind == "walk":
+                value = GRAVITY + amplitude * math.sin(2 * math.pi * phase) + 0.4 * amplitude * math.sin(4 * math.pi * phase + 0.7)
+            else:
+                value = GRAVITY
+            # Walking shakes the phone about a good deal more than standing still does
+            value += rng.gauss(0, 0.3 if kind == "walk" else 0.1)
+            lines.append("%d,%.6g" % (timestamp, value))
+            interval = int(1000000 / RATE + rng.gauss(0, 1500))
+            if kind == "walk":
+                before = phase
+                phase += interval / 1000000 / period
+                # The peak of each step is a quarter of the way into it
+                if math.floor(before - 0.25) != math.floor(phase - 0.25):
+                    steps += 1
+                if math.floor(before) != math.floor(phase):
+                    # On to the next step, which is a little different from the last one
+                    period = rng.uniform(0.93, 1.07) / cadence
+                    amplitude = strength * rng.uniform(0.75, 1.25)
+            timestamp += interval
+    with open(name, "w") as output:
+        output.write("# DIGITAiL accelerometer trace\n")
+        output.write("# Synthetic: %s (made by generate.py)\n" % description)
+        output.write("# steps=%d\n" % steps)
+        output.write("\n".join(lines))
+        output.write("\n")
+
+
+trace("walk-normal.csv", "a minute of walking at 1.8 steps per second", [("walk", 60, 1.8, 2.0)], 1)
+trace("walk-slow.csv", "45 seconds of slow walking at 1.4 steps per second", [("walk", 45, 1.4, 1.5)], 2)
+trace("walk-brisk.csv", "40 seconds of brisk walking at 2.2 steps per second", [("walk", 40, 2.2, 2.5)], 3)
+trace("standing.csv", "half a minute of standing still", [("still", 30, 0, 0)], 4)
+trace("walk-stop-walk.csv", "walking, standing for a bit, a gap in the readings, and walking again",
+      [("walk", 20, 1.8, 2.0), ("still", 8, 0, 0), ("gap", 3, 0, 0), ("walk", 25, 1.9, 2.0)], 5)
@@ -0,0 +1,303 @@
+/*
+ *   Copyright 2021 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#include "AccelerometerTrace.h"
+#include "StepDetector.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QTest>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Count every allocation made while countAllocations is set, so we can tell whether
+// the step detection allocates anything as the readings go through it
+static std::atomic<bool> countAllocations{false};
+static std::atomic<qint64> allocations{0};
+
+void* operator new(std::size_t size)
+{
+    if (countAllocations) {
+        ++allocations;
+    }
+    void* memory = std::malloc(size ? size : 1);
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+namespace {
+    // The same as in StepDetector.cpp
+    const qreal gravity{9.8};
+    const quint64 maximumSampleGap{500000};
+    const int medianWindow{5};
+    const int meanWindow{20};
+    const quint64 stepWindow{300000};
+    const qreal stepThreshold{0.3};
+
+    inline float median3(float a, float b, float c)
+    {
+        return qMax(qMin(a, b), qMin(qMax(a, b), c));
+    }
+
+    // A branchless sorting network, which the compiler is free to vectorise across readings
+    inline float median5(float a, float b, float c, float d, float e)
+    {
+        return median3(e, qMax(qMin(a, b), qMin(c, d)), qMin(qMax(a, b), qMax(c, d)));
+    }
+
+    /**
+     * The same detection as StepDetector, done over a whole block of readings at a time
+     * instead, using float32 values and a sorting network for the median. This is what
+     * the streaming detector is measured against, to see whether it is worth collecting
+     * readings up into blocks (and so detecting steps later than they happen) in order
+     * to process them this way.
+     */
+    class BlockStepDetector
+    {
+    public:
+        // Reserve space for the given number of readings, so detecting steps allocates nothing
+        void reserve(int count)
+        {
+            values.reserve(count);
+            filtered.reserve(count);
+        }
+
+        int detect(const QVector<AccelerometerTrace::Sample>& samples)
+        {
+            // Like StepDetector, start over whenever there is a gap in the readings
+            int steps{0};
+            int start{0};
+            for (int i = 1; i <= samples.count(); ++i) {
+                if (i == samples.count() || samples.at(i).timestamp > samples.at(i - 1).timestamp + maximumSampleGap) {
+                    steps += detectInRun(samples.constData() + start, i - start);
+                    start = i;
+                }
+            }
+            return steps;
+        }
+    private:
+        QVector<float> values;
+        QVector<float> filtered;
+
+        int detectInRun(const AccelerometerTrace::Sample* samples, int count)
+        {
+            if (count < medianWindow + meanWindow) {
+                return 0;
+            }
+            values.resize(count);
+            filtered.resize(count);
+            float* value = values.data();
+            float* median = filtered.data();
+            for (int i = 0; i < count; ++i) {
+                value[i] = float(samples[i].zValue - gravity);
+            }
+            // The median of the readings before each one
+            for (int i = medianWindow; i < count; ++i) {
+                median[i] = median5(value[i - 5], value[i - 4], value[i - 3], value[i - 2], value[i - 1]);
+            }
+            // The demeaning and crossing detection, which depend on what came before, in one pass
+            const int first = medianWindow + meanWindow - 1;
+            qreal sum{0};
+            for (int i = medianWindow; i <= first; ++i) {
+                sum += median[i];
+            }
+            int steps{0};
+            qreal previous{0};
+            quint64 stepDeadline{0};
+            for (int i = first; i < count; ++i) {
+                if (i > first) {
+                    sum += median[i] - median[i - meanWindow];
+                }
+                const qreal current = median[i] - sum / meanWindow;
+                if (previous < 0 && current > 0) {
+                    stepDeadline = samples[i].timestamp + stepWindow;
+                }
+                if (stepDeadline > 0) {
+                    if (samples[i].timestamp > stepDeadline) {
+                        stepDeadline = 0;
+                    } else if (current > stepThreshold) {
+                        ++steps;
+                        stepDeadline = 0;
+                    }
+                }
+                previous = current;
+            }
+            return steps;
+        }
+    };
+}
+
+class StepDetectorTest : public QObject
+{
+    Q_OBJECT
+    // The labelled traces in the given directory under data/walking
+    QStringList traceFiles(const QString& directory) const
+    {
+        const QString path = QFINDTESTDATA(QString("data/walking/%1").arg(directory));
+        QStringList filenames;
+        if (path.isEmpty()) {
+            return filenames;
+        }
+        const QDir traces(path);
+        for (const QString& filename : traces.entryList(QStringList{QLatin1String("*.csv")}, QDir::Files, QDir::Name)) {
+            filenames << traces.absoluteFilePath(filename);
+        }
+        return filenames;
+    }
+
+    void checkTrace(const QString& filename)
+    {
+        const AccelerometerTrace::ReplayResult result = AccelerometerTrace::replay(filename);
+        QVERIFY2(result.valid, qPrintable(filename));
+        QVERIFY2(result.expectedSteps > -1, qPrintable(QString("%1 is not labelled with the number of steps in it").arg(filename)));
+        qDebug() << filename << result.samples << "readings," << result.steps << "steps found of" << result.expectedSteps << "at" << result.nanosecondsPerSample << "ns per reading";
+        QVERIFY2(qAbs(result.steps - result.expectedSteps) * 10 <= result.expectedSteps,
+                 qPrintable(QString("Found %1 steps in %2, expected %3").arg(result.steps).arg(filename).arg(result.expectedSteps)));
+    }
+private Q_SLOTS:
+    void syntheticTraces_data()
+    {
+        QTest::addColumn<QString>("filename");
+        const QStringList filenames = traceFiles(QLatin1String{"synthetic"});
+        QVERIFY(!filenames.isEmpty());
+        for (const QString& filename : filenames) {
+            QTest::newRow(qPrintable(QFileInfo(filename).fileName())) << filename;
+        }
+    }
+
+    // The traces made by generate.py, which must each come within 10% of the number of steps
+    // they are labelled with. These steps are made the same way as the detector looks for
+    // them, so this only catches changes which break the detection, and says nothing about
+    // how well it counts the steps of an actual walk (see recordedTraces for that)
+    void syntheticTraces()
+    {
+        QFETCH(QString, filename);
+        checkTrace(filename);
+    }
+
+    // The same check as digitail -replay-walking, on traces recorded during actual walks
+    void recordedTraces()
+    {
+        const QStringList filenames = traceFiles(QLatin1String{"recorded"});
+        if (filenames.isEmpty()) {
+            QSKIP("There are no recorded traces to check against (see data/walking/recorded/README)");
+        }
+        for (const QString& filename : filenames) {
+            checkTrace(filename);
+            if (QTest::currentTestFailed()) {
+                return;
+            }
+        }
+    }
+
+    void noAllocationsPerSample()
+    {
+        QVector<AccelerometerTrace::Sample> samples;
+        int expectedSteps{-1};
+        QVERIFY(AccelerometerTrace::load(QFINDTESTDATA("data/walking/synthetic/walk-stop-walk.csv"), &samples, &expectedSteps));
+        QVERIFY(!samples.isEmpty());
+
+        StepDetector detector;
+        int steps{0};
+        allocations = 0;
+        countAllocations = true;
+        for (const AccelerometerTrace::Sample& sample : qAsConst(samples)) {
+            if (detector.addSample(sample.timestamp, sample.zValue)) {
+                ++steps;
+            }
+        }
+        countAllocations = false;
+        QVERIFY(steps > 0);
+        qDebug() << qreal(allocations) / samples.count() << "allocations per reading";
+        QCOMPARE(qint64(allocations), qint64(0));
+    }
+
+    void benchmark()
+    {
+        QVector<AccelerometerTrace::Sample> samples;
+        int expectedSteps{-1};
+        QVERIFY(AccelerometerTrace::load(QFINDTESTDATA("data/walking/synthetic/walk-normal.csv"), &samples, &expectedSteps));
+        StepDetector detector;
+        int steps{0};
+        QBENCHMARK {
+            detector.reset();
+            steps = 0;
+            for (const AccelerometerTrace::Sample& sample : qAsConst(samples)) {
+                if (detector.addSample(sample.timestamp, sample.zValue)) {
+                    ++steps;
+                }
+            }
+        }
+        QVERIFY(steps > 0);
+    }
+
+    void blockMatchesStreaming_data()
+    {
+        syntheticTraces_data();
+    }
+
+    // The block detection is only a fair comparison if it finds the same steps
+    void blockMatchesStreaming()
+    {
+        QFETCH(QString, filename);
+        QVector<AccelerometerTrace::Sample> samples;
+        int expectedSteps{-1};
+        QVERIFY(AccelerometerTrace::load(filename, &samples, &expectedSteps));
+        StepDetector detector;
+        int steps{0};
+        for (const AccelerometerTrace::Sample& sample : qAsConst(samples)) {
+            if (detector.addSample(sample.timestamp, sample.zValue)) {
+                ++steps;
+            }
+        }
+        BlockStepDetector blockDetector;
+        QCOMPARE(blockDetector.detect(samples), steps);
+    }
+
+    // Compare against benchmark() above, which goes through the same trace one reading at a time
+    void blockBenchmark()
+    {
+        QVector<AccelerometerTrace::Sample> samples;
+        int expectedSteps{-1};
+        QVERIFY(AccelerometerTrace::load(QFINDTESTDATA("data/walking/synthetic/walk-normal.csv"), &samples, &expectedSteps));
+        BlockStepDetector detector;
+        detector.reserve(samples.count());
+        int steps{0};
+        QBENCHMARK {
+            steps = detector.detect(samples);
+        }
+        QVERIFY(steps > 0);
+    }
+};
+
+QTEST_GUILESS_MAIN(StepDetectorTest)
+
+#include "stepdetectortest.moc"
@@ -0,0 +1,188 @@
+/*
+ *   Copyright 2021 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#include "TailNotificationParser.h"
+
+#include <QRandomGenerator>
+#include <QTest>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Count every allocation made while countAllocations is set, so we can tell whether
+// the parser allocates anything while it is being fed
+static std::atomic<bool> countAllocations{false};
+static std::atomic<qint64> allocations{0};
+
+void* operator new(std::size_t size)
+{
+    if (countAllocations) {
+        ++allocations;
+    }
+    void* memory = std::malloc(size ? size : 1);
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+namespace {
+    // None of these is the start of another, so a name cut off at the end of a notification
+    // is never mistaken for a complete one (see TailNotificationParser::Handler::tailCommandId)
+    const char* const knownCommands[] = {"TAILS1", "TAILS2", "TAILHM", "TAILER", "TAILFA", "LEDON", "LEDREC"};
+    const int knownCommandCount = sizeof(knownCommands) / sizeof(knownCommands[0]);
+}
+
+class TailNotificationParserTest : public QObject, public TailNotificationParser::Handler
+{
+    Q_OBJECT
+public:
+    struct Event {
+        TailNotificationParser::Event event;
+        int commandId;
+    };
+    QVector<Event> events;
+
+    void tailEvent(TailNotificationParser::Event event, int commandId) override
+    {
+        events << Event{event, commandId};
+    }
+
+    int tailCommandId(QLatin1String command) const override
+    {
+        for (int i = 0; i < knownCommandCount; ++i) {
+            if (command == QLatin1String(knownCommands[i])) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    QStringList eventStrings() const
+    {
+        QStringList strings;
+        for (const Event& event : events) {
+            strings << QString("%1 %2").arg(event.event == TailNotificationParser::Begin ? "BEGIN" : "END").arg(knownCommands[event.commandId]);
+        }
+        return strings;
+    }
+
+private Q_SLOTS:
+    void init()
+    {
+        events.clear();
+    }
+
+    // Notifications in the shapes the tail sends them in
+    void replay_data()
+    {
+        QTest::addColumn<QList<QByteArray>>("notifications");
+        QTest::addColumn<QStringList>("expected");
+
+        QTest::newRow("single begin") << QList<QByteArray>{"BEGIN TAILS1"} << QStringList{"BEGIN TAILS1"};
+        QTest::newRow("begin and end") << QList<QByteArray>{"BEGIN TAILS1", "END TAILS1"} << QStringList{"BEGIN TAILS1", "END TAILS1"};
+        QTest::newRow("merged") << QList<QByteArray>{"END TAILS1BEGIN TAILHM"} << QStringList{"END TAILS1", "BEGIN TAILHM"};
+        QTest::newRow("merged three") << QList<QByteArray>{"END TAILS1BEGIN TAILHMEND TAILHM"} << QStringList{"END TAILS1", "BEGIN TAILHM", "END TAILHM"};
+        QTest::newRow("split in name") << QList<QByteArray>{"END TAILS1BEGIN TAIL", "HM"} << QStringList{"END TAILS1", "BEGIN TAILHM"};
+        QTest::newRow("split in keyword") << QList<QByteArray>{"END TAILS1BE", "GIN TAILHM"} << QStringList{"END TAILS1", "BEGIN TAILHM"};
+        QTest::newRow("split before space") << QList<QByteArray>{"BEGIN", " LEDON"} << QStringList{"BEGIN LEDON"};
+        QTest::newRow("split every byte") << QList<QByteArray>{"E", "N", "D", " ", "L", "E", "D", "R", "E", "C", "B", "E", "G", "I", "N", " ", "T", "A", "I", "L", "E", "R"} << QStringList{"END LEDREC", "BEGIN TAILER"};
+        QTest::newRow("truncated, then a complete event") << QList<QByteArray>{"BEGIN TAI", "END TAILS2"} << QStringList{"END TAILS2"};
+        QTest::newRow("truncated keyword") << QList<QByteArray>{"BEG", "END TAILS2"} << QStringList{"END TAILS2"};
+        QTest::newRow("unknown command") << QList<QByteArray>{"BEGIN NOTACOMMAND", "END TAILFA"} << QStringList{"END TAILFA"};
+        QTest::newRow("unknown merged with known") << QList<QByteArray>{"END NOTACOMMANDBEGIN TAILFA"} << QStringList{"BEGIN TAILFA"};
+        QTest::newRow("unknown keyword") << QList<QByteArray>{"STARTED TAILS1", "END TAILS1"} << QStringList{"END TAILS1"};
+        QTest::newRow("other messages around events") << QList<QByteArray>{"Hello there END TAILS1"} << QStringList{"END TAILS1"};
+        QTest::newRow("overlong name") << QList<QByteArray>{"BEGIN " + QByteArray(TailNotificationParser::MaximumCommandLength * 2, 'X'), " END TAILHM"} << QStringList{"END TAILHM"};
+        QTest::newRow("empty notifications") << QList<QByteArray>{"", "BEGIN TAILS1", ""} << QStringList{"BEGIN TAILS1"};
+    }
+
+    void replay()
+    {
+        QFETCH(QList<QByteArray>, notifications);
+        QFETCH(QStringList, expected);
+        TailNotificationParser parser(this);
+        for (const QByteArray& notification : notifications) {
+            parser.feed(notification);
+        }
+        QCOMPARE(eventStrings(), expected);
+    }
+
+    void resetDropsPartialEvents()
+    {
+        TailNotificationParser parser(this);
+        parser.feed("END TAILS1BEGIN TAIL");
+        parser.reset();
+        parser.feed("HM");
+        parser.feed("BEGIN LEDON");
+        QCOMPARE(eventStrings(), (QStringList{"END TAILS1", "BEGIN LEDON"}));
+    }
+
+    // A long random stream of events, squashed together the way the tail does it, and cut
+    // up into notifications at random places, must come out as the same events
+    void fuzz()
+    {
+        QRandomGenerator random(1234);
+        for (int round = 0; round < 200; ++round) {
+            QByteArray stream;
+            QStringList expected;
+            const int eventCount = random.bounded(1, 40);
+            for (int i = 0; i < eventCount; ++i) {
+                const char* keyword = random.bounded(2) ? "BEGIN" : "END";
+                const char* command = knownCommands[random.bounded(knownCommandCount)];
+                stream += keyword;
+                stream += ' ';
+                stream += command;
+                expected << QString("%1 %2").arg(keyword).arg(command);
+            }
+            QList<QByteArray> notifications;
+            int position = 0;
+            while (position < stream.length()) {
+                const int length = random.bounded(1, 21);
+                notifications << stream.mid(position, length);
+                position += length;
+            }
+
+            events.clear();
+            events.reserve(eventCount);
+            TailNotificationParser parser(this);
+            allocations = 0;
+            countAllocations = true;
+            for (const QByteArray& notification : qAsConst(notifications)) {
+                parser.feed(notification);
+            }
+            countAllocations = false;
+            QCOMPARE(qint64(allocations), qint64(0));
+            QCOMPARE(eventStrings(), expected);
+        }
+    }
+};
+
+QTEST_GUILESS_MAIN(TailNotificationParserTest)
+
+#include "tailnotificationparsertest.moc"
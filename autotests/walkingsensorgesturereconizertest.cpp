@@ -0,0 +1,97 @@
+/*
+ *   Copyright 2021 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#include "WalkingSensorGestureReconizer.h"
+
+#include <QEvent>
+#include <QTest>
+#include <QThread>
+
+#include <QtMath>
+
+class WalkingSensorGestureReconizerTest : public QObject
+{
+    Q_OBJECT
+public:
+    // Counts the events posted to the object it is installed on, which for an object on the
+    // main thread is every time another thread hands something over to the main thread
+    class EventCounter : public QObject
+    {
+    public:
+        int metaCalls{0};
+        bool eventFilter(QObject* /*watched*/, QEvent* event) override
+        {
+            if (event->type() == QEvent::MetaCall) {
+                ++metaCalls;
+            }
+            return false;
+        }
+    };
+
+    // Twenty seconds of walking at a little under two steps a second, sampled at 30Hz
+    static QVector<AccelerometerTrace::Sample> walk()
+    {
+        static const int rate{30};
+        static const qreal stepsPerSecond{1.8};
+        QVector<AccelerometerTrace::Sample> samples;
+        for (int i = 0; i < 20 * rate; ++i) {
+            const qreal seconds = qreal(i) / rate;
+            const qreal zValue = 9.8 + 2 * qSin(2 * M_PI * stepsPerSecond * seconds) + 0.8 * qSin(4 * M_PI * stepsPerSecond * seconds + 0.7);
+            samples << AccelerometerTrace::Sample{quint64(1000000 + i * 1000000 / rate), zValue};
+        }
+        return samples;
+    }
+
+private Q_SLOTS:
+    void detectsOnWorkerThread()
+    {
+        WalkingSensorGestureReconizer recognizer;
+        recognizer.create();
+        EventCounter counter;
+        recognizer.installEventFilter(&counter);
+
+        QStringList gestures;
+        bool allOnMainThread{true};
+        QThread* mainThread = QThread::currentThread();
+        connect(&recognizer, &QSensorGestureRecognizer::detected, this, [&](const QString& gesture){
+            gestures << gesture;
+            allOnMainThread = allOnMainThread && QThread::currentThread() == mainThread;
+        }, Qt::DirectConnection);
+
+        const QVector<AccelerometerTrace::Sample> samples = walk();
+        // This blocks the main thread until the worker is done with all the readings, so
+        // if anything got found, it was found on the worker thread...
+        recognizer.replay(samples);
+        // ...and nothing gets delivered to the main thread until its event loop gets to run
+        QCOMPARE(gestures.count(), 0);
+        QCOMPARE(counter.metaCalls, 0);
+
+        QCoreApplication::processEvents();
+        const int steps = gestures.count(QLatin1String("stepDetected"));
+        QVERIFY2(steps >= 25, qPrintable(QString("Only found %1 steps").arg(steps)));
+        QCOMPARE(gestures.count(QLatin1String("walkingStarted")), 1);
+        QCOMPARE(gestures.count(QLatin1String("oddStepDetected")) + gestures.count(QLatin1String("evenStepDetected")), steps);
+        QVERIFY(allOnMainThread);
+        // Exactly one handover to the main thread per gesture, and none per reading
+        QCOMPARE(counter.metaCalls, gestures.count());
+        QVERIFY(counter.metaCalls < samples.count());
+    }
+};
+
+QTEST_GUILESS_MAIN(WalkingSensorGestureReconizerTest)
+
+#include "walkingsensorgesturereconizertest.moc"
@@ -0,0 +1,145 @@
+/*
+ *   Copyright 2021 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#include "AccelerometerTrace.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTextStream>
+
+#include "StepDetector.h"
+
+class AccelerometerTrace::Private
+{
+public:
+    Private() {}
+    ~Private() {}
+
+    QFile file;
+    QTextStream stream;
+};
+
+AccelerometerTrace::AccelerometerTrace()
+    : d(new Private)
+{
+}
+
+AccelerometerTrace::~AccelerometerTrace()
+{
+    stopRecording();
+    delete d;
+}
+
+bool AccelerometerTrace::startRecording(const QString& filename)
+{
+    stopRecording();
+    d->file.setFileName(filename);
+    if (!d->file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        qWarning() << "Could not open" << filename << "to record accelerometer readings to:" << d->file.errorString();
+        return false;
+    }
+    qDebug() << "Recording accelerometer readings to" << filename;
+    d->stream.setDevice(&d->file);
+    d->stream << "# DIGITAiL accelerometer trace\n";
+    d->stream << "# Add the number of steps taken during the recording as a line like this: # steps=123\n";
+    return true;
+}
+
+void AccelerometerTrace::record(const Sample& sample)
+{
+    d->stream << sample.timestamp << ',' << QString::number(sample.zValue, 'g', 8) << '\n';
+}
+
+void AccelerometerTrace::stopRecording()
+{
+    if (d->file.isOpen()) {
+        d->stream.flush();
+        d->stream.setDevice(nullptr);
+        d->file.close();
+    }
+}
+
+bool AccelerometerTrace::isRecording() const
+{
+    return d->file.isOpen();
+}
+
+bool AccelerometerTrace::load(const QString& filename, QVector<Sample>* samples, int* expectedSteps)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning() << "Could not open the accelerometer trace" << filename << file.errorString();
+        return false;
+    }
+    static const QLatin1String stepsLabel{"# steps="};
+    *expectedSteps = -1;
+    samples->clear();
+    QTextStream stream(&file);
+    QString line;
+    while (stream.readLineInto(&line)) {
+        if (line.startsWith(stepsLabel)) {
+            *expectedSteps = line.midRef(stepsLabel.size()).trimmed().toInt();
+        } else if (!line.startsWith('#') && !line.trimmed().isEmpty()) {
+            const int separator = line.indexOf(',');
+            bool timestampOk{false};
+            bool valueOk{false};
+            const Sample sample{line.leftRef(separator).toULongLong(&timestampOk), qreal(line.midRef(separator + 1).toDouble(&valueOk))};
+            if (separator < 0 || !timestampOk || !valueOk) {
+                qWarning() << "Skipping an unreadable line in the accelerometer trace" << filename << line;
+                continue;
+            }
+            samples->append(sample);
+        }
+    }
+    return true;
+}
+
+AccelerometerTrace::ReplayResult AccelerometerTrace::replay(const QString& filename)
+{
+    ReplayResult result;
+    QVector<Sample> samples;
+    if (!load(filename, &samples, &result.expectedSteps)) {
+        return result;
+    }
+    result.valid = true;
+    result.samples = samples.count();
+    if (samples.isEmpty()) {
+        return result;
+    }
+
+    // Go through the trace a few times, for a more stable measurement of the time taken
+    static const qint64 minimumDuration{200000000};
+    static const int maximumPasses{1000};
+    StepDetector detector;
+    QElapsedTimer timer;
+    int passes{0};
+    timer.start();
+    do {
+        detector.reset();
+        int steps{0};
+        for (const Sample& sample : qAsConst(samples)) {
+            if (detector.addSample(sample.timestamp, sample.zValue)) {
+                ++steps;
+            }
+        }
+        result.steps = steps;
+        ++passes;
+    } while (timer.nsecsElapsed() < minimumDuration && passes < maximumPasses);
+    result.nanosecondsPerSample = qreal(timer.nsecsElapsed()) / (qreal(passes) * samples.count());
+    return result;
+}
@@ -0,0 +1,94 @@
+/*
+ *   Copyright 2021 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#ifndef ACCELEROMETERTRACE_H
+#define ACCELEROMETERTRACE_H
+
+#include <QString>
+#include <QVector>
+
+/**
+ * Records accelerometer readings to a trace file, and replays them through the
+ * StepDetector, so changes to the step detection can be checked against real
+ * walks without having to go for one each time.
+ *
+ * A trace is a CSV file with a timestamp (in microseconds) and the z value of one
+ * reading on each line. Lines starting with # are comments, except for one of the
+ * form "# steps=123", which gives the number of steps actually taken during the
+ * recording, and should be added by hand once the trace has been recorded.
+ */
+class AccelerometerTrace
+{
+public:
+    AccelerometerTrace();
+    ~AccelerometerTrace();
+
+    struct Sample {
+        quint64 timestamp; // In microseconds, as reported by the sensor
+        qreal zValue;
+    };
+
+    /**
+     * Start recording readings to the given file, replacing anything already in it
+     * @param filename The file to record to
+     * @return True if the file could be opened for writing, otherwise false
+     */
+    bool startRecording(const QString& filename);
+    /**
+     * Add a reading to the trace being recorded
+     * @param sample The reading
+     */
+    void record(const Sample& sample);
+    /**
+     * Stop recording, and close the trace file
+     */
+    void stopRecording();
+    bool isRecording() const;
+
+    /**
+     * Read the readings from a trace file
+     * @param filename The trace file
+     * @param samples Filled with the readings from the trace
+     * @param expectedSteps Set to the number of steps taken during the recording, or -1 if the trace does not say
+     * @return True if the file could be read, otherwise false
+     */
+    static bool load(const QString& filename, QVector<Sample>* samples, int* expectedSteps);
+
+    struct ReplayResult {
+        bool valid{false};
+        int samples{0};
+        int steps{0};
+        int expectedSteps{-1};
+        qreal nanosecondsPerSample{0};
+    };
+    /**
+     * Feed the readings from a trace file through the step detection as fast as it will
+     * go. The readings are all loaded before the detection starts, and fed through it
+     * several times over, so the timing only covers the detection itself.
+     * @note This does not count allocations per reading, as that needs the global operator
+     * new replaced, which the app itself should not do. stepdetectortest does that instead,
+     * and checks that the detection allocates nothing.
+     * @param filename The trace file
+     * @return The number of steps found, and how long the detection took per reading
+     */
+    static ReplayResult replay(const QString& filename);
+private:
+    class Private;
+    Private* d;
+};
+
+#endif//ACCELEROMETERTRACE_H
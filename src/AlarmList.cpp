@@ -59,8 +59,8 @@ public:
                 {
 //                     qDebug() << "Event is within our check interval, so launch it now";
                     commandQueue->clear({});
-                    commandQueue->pushPause(until, {});
-                    commandQueue->pushCommands(alarm->commands(), {});
+                    commandQueue->pushPause(until, {}, CommandQueue::AlarmPriority);
+                    commandQueue->pushCommands(alarm->commands(), {}, CommandQueue::AlarmPriority);
                     break;
                 }
                 // TODO This doesn't handle two alarms set to go off within the same interval (in other words
@@ -43,6 +43,8 @@ public:
     int idleMinPause = 15;
     int idleMaxPause = 60;
     bool fakeTailMode = false;
+    bool synchronizedDispatch = false;
+    int synchronizedDispatchSkew = 20;
 
     QMap<QString, QStringList> moveLists;
     QString activeMoveListName;
@@ -51,7 +53,25 @@ public:
     QString activeAlarmName;
 
     QVariantMap commandFiles;
+    // The compiled versions of the command files, keyed by the hash of their contents
+    // (so files with the same contents share the one compiled version), and the hash
+    // of the contents of each command file
+    QHash<QByteArray, QByteArray> compiledCommandFiles;
+    QHash<QString, QByteArray> commandFileHashes;
     bool isInitialized{false};
+
+    void forgetCompiledCommandFile(const QString& filename)
+    {
+        const QByteArray hash = commandFileHashes.take(filename);
+        if (!hash.isEmpty()) {
+            for (const QByteArray& otherHash : qAsConst(commandFileHashes)) {
+                if (otherHash == hash) {
+                    return;
+                }
+            }
+            compiledCommandFiles.remove(hash);
+        }
+    }
 };
 
 AppSettings::AppSettings(QObject* parent)
@@ -68,6 +88,8 @@ AppSettings::AppSettings(QObject* parent)
     d->idleMinPause = settings.value("idleMinPause", d->idleMinPause).toInt();
     d->idleMaxPause = settings.value("idleMaxPause", d->idleMaxPause).toInt();
     d->fakeTailMode = settings.value("fakeTailMode", d->fakeTailMode).toBool();
+    d->synchronizedDispatch = settings.value("synchronizedDispatch", d->synchronizedDispatch).toBool();
+    d->synchronizedDispatchSkew = settings.value("synchronizedDispatchSkew", d->synchronizedDispatchSkew).toInt();
 
     settings.beginGroup("MoveLists");
     QStringList moveLists = settings.allKeys();
@@ -294,6 +316,38 @@ void AppSettings::setFakeTailMode(bool fakeTailMode)
     }
 }
 
+bool AppSettings::synchronizedDispatch() const
+{
+    return d->synchronizedDispatch;
+}
+
+void AppSettings::setSynchronizedDispatch(bool synchronizedDispatch)
+{
+    qDebug() << Q_FUNC_INFO << synchronizedDispatch;
+    if(synchronizedDispatch != d->synchronizedDispatch) {
+        d->synchronizedDispatch = synchronizedDispatch;
+        QSettings settings;
+        settings.setValue("synchronizedDispatch", d->synchronizedDispatch);
+        emit synchronizedDispatchChanged(synchronizedDispatch);
+    }
+}
+
+int AppSettings::synchronizedDispatchSkew() const
+{
+    return d->synchronizedDispatchSkew;
+}
+
+void AppSettings::setSynchronizedDispatchSkew(int synchronizedDispatchSkew)
+{
+    qDebug() << Q_FUNC_INFO << synchronizedDispatchSkew;
+    if(synchronizedDispatchSkew != d->synchronizedDispatchSkew) {
+        d->synchronizedDispatchSkew = synchronizedDispatchSkew;
+        QSettings settings;
+        settings.setValue("synchronizedDispatchSkew", d->synchronizedDispatchSkew);
+        emit synchronizedDispatchSkewChanged(synchronizedDispatchSkew);
+    }
+}
+
 QStringList AppSettings::moveLists() const
 {
     QStringList keys = d->moveLists.keys();
@@ -512,6 +566,7 @@ void AppSettings::removeCommandFile(const QString& filename)
     QVariantMap fileMap = d->commandFiles[filename].toMap();
     if (fileMap[QLatin1String{"isEditable"}].toBool()) {
         d->commandFiles.remove(filename);
+        d->forgetCompiledCommandFile(filename);
         emit commandFilesChanged(d->commandFiles);
     }
 }
@@ -540,10 +595,25 @@ void AppSettings::setCommandFileContents(const QString& filename, const QString&
 
         fileMap[QLatin1String{"contents"}] = content;
         fileMap[QLatin1String{"isValid"}] = false;
+        d->forgetCompiledCommandFile(filename);
 
+        // Compile the contents once here, so the devices can load the commands
+        // without having to parse the json every time they (re)connect
+        const QByteArray hash = CommandPersistence::contentHash(content);
         CommandPersistence persistence;
-        persistence.deserialize(content);
-        if (persistence.error().isEmpty()) {
+        bool isValid{false};
+        if (d->compiledCommandFiles.contains(hash)) {
+            isValid = persistence.deserializeCompiled(d->compiledCommandFiles.value(hash), hash);
+        }
+        if (!isValid) {
+            persistence.deserialize(content);
+            if (persistence.error().isEmpty()) {
+                d->compiledCommandFiles[hash] = persistence.compiled(hash);
+                isValid = true;
+            }
+        }
+        if (isValid) {
+            d->commandFileHashes[filename] = hash;
             fileMap[QLatin1String{"title"}] = persistence.title();
             fileMap[QLatin1String{"description"}] = persistence.description();
             fileMap[QLatin1String{"isValid"}] = true;
@@ -558,6 +628,23 @@ void AppSettings::renameCommandFile(const QString& filename, const QString& newF
     QVariantMap fileMap = d->commandFiles.take(filename).toMap();
     if (fileMap[QLatin1String{"isEditable"}].toBool()) {
         d->commandFiles[newFilename] = fileMap;
+        // If we are renaming on top of another file, that file's compiled form goes away with it
+        if (newFilename != filename) {
+            d->forgetCompiledCommandFile(newFilename);
+        }
+        if (d->commandFileHashes.contains(filename)) {
+            d->commandFileHashes[newFilename] = d->commandFileHashes.take(filename);
+        }
         emit commandFilesChanged(d->commandFiles);
     }
 }
+
+QByteArray AppSettings::compiledCommandFile(const QString& filename) const
+{
+    return d->compiledCommandFiles.value(d->commandFileHashes.value(filename));
+}
+
+QByteArray AppSettings::commandFileHash(const QString& filename) const
+{
+    return d->commandFileHashes.value(filename);
+}
@@ -58,6 +58,22 @@ public:
     bool fakeTailMode() const override;
     void setFakeTailMode(bool fakeTailMode) override;
 
+    /**
+     * When enabled, commands sent to several devices at once are written to the
+     * devices with the shortest delay (see BTDevice::oneWayDelay()) a little later
+     * than the others, so that all the devices start the command at the same time.
+     */
+    bool synchronizedDispatch() const override;
+    void setSynchronizedDispatch(bool synchronizedDispatch) override;
+
+    /**
+     * The difference (in milliseconds) in when devices start a command which is
+     * considered close enough, when synchronizedDispatch is enabled. Devices whose
+     * delay is within this of the slowest device are not held back.
+     */
+    int synchronizedDispatchSkew() const override;
+    void setSynchronizedDispatchSkew(int synchronizedDispatchSkew) override;
+
     QStringList moveLists() const override;
     QStringList moveList() const override;
     void setActiveMoveList(const QString& moveListName) override;
@@ -94,6 +110,14 @@ public:
     // Changing the content will reset the title and description, but only if it is valid (or they will be retained in the current session)
     void setCommandFileContents(const QString& filename, const QString& content) override;
     void renameCommandFile(const QString& filename, const QString& newFilename) override;
+    /// We have access to this method only from the Service
+    /// The compiled version of the contents of the named command file (see CommandPersistence::compiled()),
+    /// produced when the contents were set. This is empty if there is no such file, or its contents are invalid.
+    QByteArray compiledCommandFile(const QString& filename) const;
+    /// We have access to this method only from the Service
+    /// The hash of the contents of the named command file (see CommandPersistence::contentHash()), which
+    /// is empty if there is no such file, or its contents are invalid.
+    QByteArray commandFileHash(const QString& filename) const;
 
     /// We have access to this method only from the Service.
     /// See BTConnectionManager::setDeviceName() method
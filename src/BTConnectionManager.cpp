@@ -23,14 +23,19 @@
 #include "TailCommandModel.h"
 #include "CommandQueue.h"
 #include "AppSettings.h"
+#include "TimerWheel.h"
 
 #include <QBluetoothDeviceDiscoveryAgent>
 #include <QBluetoothServiceDiscoveryAgent>
 #include <QBluetoothLocalDevice>
 #include <QCoreApplication>
 #include <QLowEnergyController>
+#include <QPointer>
 #include <QTimer>
 
+#include <algorithm>
+#include <limits>
+
 class BTConnectionManager::Private {
 public:
     Private()
@@ -53,6 +58,45 @@ public:
 
     QBluetoothLocalDevice* localDevice{nullptr};
     int localBTDeviceState{0};
+
+    // When connecting to all devices, we keep at most this many attempts going at the same time,
+    // and if an attempt has not succeeded or failed after this long, we give up on it
+    static const int maxConcurrentConnections{2};
+    static const int connectionAttemptTimeout{20000};
+    // The devices waiting for their turn to connect, strongest signal first
+    QList<QPointer<BTDevice>> connectQueue;
+    // The devices we are currently connecting to, and the timeouts for those attempts
+    QHash<BTDevice*, TimerWheel::Handle> connecting;
+
+    void connectNext()
+    {
+        while (connecting.count() < maxConcurrentConnections && !connectQueue.isEmpty()) {
+            BTDevice* device = connectQueue.takeFirst();
+            if (!device || device->isConnected()) {
+                continue;
+            }
+            qDebug() << "Connecting to" << device->name() << device->deviceID() << "with last seen signal strength" << device->deviceInfo.rssi() << "-" << connectQueue.count() << "devices waiting";
+            device->cancelReconnect();
+            device->connectDevice();
+            connecting[device] = TimerWheel::getInstance()->schedule(connectionAttemptTimeout, device, [this, device](){
+                qDebug() << "Gave up connecting to" << device->name() << device->deviceID();
+                connecting.remove(device);
+                device->disconnectDevice();
+                connectNext();
+            });
+        }
+    }
+
+    // Called when an attempt to connect has ended, whichever way it went
+    void connectionAttemptFinished(BTDevice* device)
+    {
+        QHash<BTDevice*, TimerWheel::Handle>::iterator attempt = connecting.find(device);
+        if (attempt != connecting.end()) {
+            TimerWheel::getInstance()->cancel(attempt.value());
+            connecting.erase(attempt);
+            connectNext();
+        }
+    }
 };
 
 BTConnectionManager::BTConnectionManager(AppSettings* appSettings, QObject* parent)
@@ -79,7 +123,15 @@ BTConnectionManager::BTConnectionManager(AppSettings* appSettings, QObject* pare
             });
     connect(d->deviceModel, &BTDeviceModel::countChanged,
             this, [this](){ emit deviceCountChanged(d->deviceModel->count()); });
-    connect(d->deviceModel, &BTDeviceModel::deviceConnected, this, [this](BTDevice* device){ emit deviceConnected(device->deviceID()); });
+    connect(d->deviceModel, &BTDeviceModel::deviceConnected, this, [this](BTDevice* device){
+        d->connectionAttemptFinished(device);
+        emit deviceConnected(device->deviceID());
+    });
+    connect(d->deviceModel, &BTDeviceModel::deviceDisconnected, this, [this](BTDevice* device){ d->connectionAttemptFinished(device); });
+    connect(d->deviceModel, &BTDeviceModel::deviceRemoved, this, [this](BTDevice* device){
+        d->connectQueue.removeAll(device);
+        d->connectionAttemptFinished(device);
+    });
     connect(d->deviceModel, &BTDeviceModel::isConnectedChanged, this, &BTConnectionManager::isConnectedChanged);
 
     d->commandModel = new BTDeviceCommandModel(this);
@@ -166,13 +218,45 @@ void BTConnectionManager::connectToDevice(const QString& deviceID)
     }
     if(device) {
         qDebug() << "Attempting to connect to device" << device->name();
+        // A manual connection attempt supersedes any reconnection we were waiting to make
+        device->cancelReconnect();
         device->connectDevice();
     }
 }
 
+void BTConnectionManager::connectToAllDevices()
+{
+    for (int i = 0; i < d->deviceModel->count(); ++i) {
+        BTDevice* device = d->deviceModel->getDevice(d->deviceModel->getDeviceID(i));
+        if (device && !device->isConnected() && !d->connecting.contains(device) && !d->connectQueue.contains(device)) {
+            d->connectQueue << device;
+        }
+    }
+    // An rssi of 0 means we don't know the signal strength, so those go last
+    std::stable_sort(d->connectQueue.begin(), d->connectQueue.end(), [](const QPointer<BTDevice>& first, const QPointer<BTDevice>& second){
+        const int firstRssi = (first && first->deviceInfo.rssi() != 0) ? first->deviceInfo.rssi() : std::numeric_limits<int>::min();
+        const int secondRssi = (second && second->deviceInfo.rssi() != 0) ? second->deviceInfo.rssi() : std::numeric_limits<int>::min();
+        return firstRssi > secondRssi;
+    });
+    qDebug() << "Connecting to" << d->connectQueue.count() << "devices";
+    d->connectNext();
+}
+
+void BTConnectionManager::cancelConnectToAllDevices()
+{
+    d->connectQueue.clear();
+    const QList<BTDevice*> connecting = d->connecting.keys();
+    for (BTDevice* device : connecting) {
+        TimerWheel::getInstance()->cancel(d->connecting.take(device));
+        qDebug() << "Abandoning connection attempt to" << device->name() << device->deviceID();
+        device->disconnectDevice();
+    }
+}
+
 void BTConnectionManager::disconnectDevice(const QString& deviceID)
 {
     if(deviceID.isEmpty()) {
+        cancelConnectToAllDevices();
         // Disconnect eeeeeverything
         for (int i = 0; i < d->deviceModel->count(); ++i) {
             const QString id{d->deviceModel->getDeviceID(i)};
@@ -182,6 +266,11 @@ void BTConnectionManager::disconnectDevice(const QString& deviceID)
         }
     } else {
         BTDevice* device = d->deviceModel->getDevice(deviceID);
+        if (device) {
+            // Asking to disconnect also means not wanting us to reconnect on our own
+            device->cancelReconnect();
+            d->connectQueue.removeAll(device);
+        }
         if (device && device->isConnected()) {
             device->disconnectDevice();
             d->commandQueue->clear(device->deviceID());
@@ -259,13 +348,13 @@ QVariantMap BTConnectionManager::getCommand(const QString& command)
 {
     QVariantMap info;
     if(d->commandModel) {
-        const CommandInfo& actualCommand = d->commandModel->getCommand(command);
-        if(actualCommand.isValid()) {
-            info["category"] = actualCommand.category;
-            info["command"] = actualCommand.command;
-            info["duration"] = actualCommand.duration;
-            info["minimumCooldown"] = actualCommand.minimumCooldown;
-            info["name"] = actualCommand.name;
+        const CommandInfo* actualCommand = d->commandModel->findCommand(command);
+        if(actualCommand && actualCommand->isValid()) {
+            info["category"] = actualCommand->category;
+            info["command"] = actualCommand->command;
+            info["duration"] = actualCommand->duration;
+            info["minimumCooldown"] = actualCommand->minimumCooldown;
+            info["name"] = actualCommand->name;
         }
     }
     return info;
@@ -64,6 +64,19 @@ public:
 public Q_SLOTS:
     void sendMessage(const QString &message, const QStringList& deviceIDs) override;
     void connectToDevice(const QString& deviceID) override;
+    /**
+     * Connect to all the known devices which are not already connected. Only a few
+     * connection attempts are made at the same time (as the bluetooth stack does not
+     * deal well with lots of simultaneous attempts), starting with the devices which
+     * had the strongest signal when we last saw them.
+     */
+    void connectToAllDevices() override;
+    /**
+     * Stop connecting to all devices, as started by connectToAllDevices(). This
+     * abandons any connection attempts still in progress, and forgets the devices
+     * still waiting for their turn. Devices which are already connected stay connected.
+     */
+    void cancelConnectToAllDevices() override;
     /**
      * Disconnect from the specified device, or if no deviceID is given, disconnect from everything
      * @param deviceID The ID of the device you wish to disconnect from
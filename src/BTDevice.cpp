@@ -18,11 +18,14 @@
 #include "BTDevice.h"
 
 #include <QCoreApplication>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
 #include <QSettings>
 #include <QTimer>
 
 #include "AppSettings.h"
-#include "CommandPersistence.h"
+#include "CommandCatalogue.h"
 
 class BTDevice::Private {
 public:
@@ -33,6 +36,41 @@ public:
     QString name;
     QStringList enabledCommandsFiles;
     BTDeviceModel* parentModel;
+
+    // The round trip time is smoothed the same way TCP does it (see RFC 6298)
+    QElapsedTimer roundTrip;
+    double smoothedRoundTrip{-1};
+    double roundTripVariation{0};
+
+    // Reconnection starts out at half a second, doubling on each failure up to a minute,
+    // and after that many attempts we settle on one every five minutes
+    static const int reconnectBaseDelay{500};
+    static const int reconnectMaximumDelay{60000};
+    static const int reconnectBackoffAttempts{8};
+    static const int reconnectLowDutyDelay{300000};
+    // Seeing the device in discovery brings the next attempt forward, but advertisements
+    // arrive many times a second, so never more often than once per this many milliseconds
+    static const int reconnectSeenInterval{10000};
+    BTDevice::ReconnectState reconnectState{BTDevice::NotReconnecting};
+    int reconnectAttempts{0};
+    qint64 nextReconnectAttempt{0};
+    QTimer reconnectTimer;
+    // When the most recent attempt was started (invalid if none has been made)
+    QElapsedTimer lastReconnectAttempt;
+
+    // The delay before the next attempt, with equal jitter (half fixed, half random), so that
+    // several devices which lost their connection at the same time don't all retry in lockstep
+    int reconnectDelay() const
+    {
+        int delay = reconnectLowDutyDelay;
+        if (reconnectAttempts < reconnectBackoffAttempts) {
+            delay = reconnectBaseDelay << reconnectAttempts;
+            if (delay > reconnectMaximumDelay) {
+                delay = reconnectMaximumDelay;
+            }
+        }
+        return delay / 2 + QRandomGenerator::global()->bounded(delay / 2 + 1);
+    }
 };
 
 BTDevice::BTDevice(const QBluetoothDeviceInfo& info, BTDeviceModel* parent)
@@ -53,6 +91,20 @@ BTDevice::BTDevice(const QBluetoothDeviceInfo& info, BTDeviceModel* parent)
     connect(timer, &QTimer::timeout, this, [this](){ Q_EMIT activeCommandTitlesChanged(activeCommandTitles()); });
     connect(commandModel, &QAbstractItemModel::dataChanged, this, [timer](const QModelIndex& /*topLeft*/, const QModelIndex& /*bottomRight*/, const QVector< int >& /*roles*/){ timer->start(); });
 
+    d->reconnectTimer.setSingleShot(true);
+    connect(&d->reconnectTimer, &QTimer::timeout, this, [this](){
+        if (d->parentModel && d->parentModel->appSettings() && !d->parentModel->appSettings()->autoReconnect()) {
+            cancelReconnect();
+            return;
+        }
+        ++d->reconnectAttempts;
+        d->nextReconnectAttempt = 0;
+        d->lastReconnectAttempt.start();
+        emit reconnectStateChanged();
+        qDebug() << name() << deviceID() << "Reconnection attempt" << d->reconnectAttempts;
+        attemptReconnect();
+    });
+
     QSettings settings;
     d->enabledCommandsFiles = settings.value(QString{"enabledCommandFiles-%1"}.arg(info.address().toString())).toStringList();
     connect(this, &BTDevice::enabledCommandsFilesChanged, this, [this](){
@@ -97,15 +149,131 @@ QString BTDevice::activeCommandTitles() const
 {
     QString titles;
     QString separator;
-    for(const CommandInfo& command : commandModel->allCommands()) {
-        if (command.isRunning) {
-            titles += separator + command.name;
+    for (int i = 0; i < commandModel->rowCount(); ++i) {
+        if (commandModel->isRunningAt(i)) {
+            titles += separator + commandModel->commandAt(i).name;
             separator = QString{", "};
         }
     }
     return titles;
 }
 
+int BTDevice::roundTripTime() const
+{
+    return d->smoothedRoundTrip < 0 ? -1 : qRound(d->smoothedRoundTrip);
+}
+
+int BTDevice::oneWayDelay() const
+{
+    return d->smoothedRoundTrip < 0 ? 0 : qRound(d->smoothedRoundTrip / 2);
+}
+
+void BTDevice::startRoundTrip()
+{
+    d->roundTrip.start();
+}
+
+void BTDevice::endRoundTrip()
+{
+    if (d->roundTrip.isValid()) {
+        const double sample = d->roundTrip.elapsed();
+        d->roundTrip.invalidate();
+        if (d->smoothedRoundTrip < 0) {
+            d->smoothedRoundTrip = sample;
+            d->roundTripVariation = sample / 2;
+        } else {
+            // A response which takes much longer than usual is most likely the device being
+            // busy with something else, rather than the connection changing, so leave it out
+            if (sample > d->smoothedRoundTrip + 4 * d->roundTripVariation + 1000) {
+                return;
+            }
+            d->roundTripVariation = 0.75 * d->roundTripVariation + 0.25 * qAbs(d->smoothedRoundTrip - sample);
+            d->smoothedRoundTrip = 0.875 * d->smoothedRoundTrip + 0.125 * sample;
+        }
+        emit roundTripTimeChanged(roundTripTime());
+    }
+}
+
+BTDevice::ReconnectState BTDevice::reconnectState() const
+{
+    return d->reconnectState;
+}
+
+int BTDevice::reconnectAttempts() const
+{
+    return d->reconnectAttempts;
+}
+
+qint64 BTDevice::nextReconnectAttempt() const
+{
+    return d->nextReconnectAttempt;
+}
+
+void BTDevice::deviceSeen()
+{
+    // If the timer is not running while we are reconnecting, an attempt is currently under way,
+    // and starting another would just abort that one
+    if (d->reconnectState == NotReconnecting || !d->reconnectTimer.isActive() || isConnected()) {
+        return;
+    }
+    if (d->lastReconnectAttempt.isValid() && d->lastReconnectAttempt.elapsed() < Private::reconnectSeenInterval) {
+        return;
+    }
+    if (d->reconnectTimer.remainingTime() > 0) {
+        qDebug() << name() << deviceID() << "Seen the device again, so attempting to reconnect straight away";
+        d->reconnectTimer.setTimerType(Qt::CoarseTimer);
+        d->reconnectTimer.start(0);
+        d->nextReconnectAttempt = QDateTime::currentMSecsSinceEpoch();
+        emit reconnectStateChanged();
+    }
+}
+
+void BTDevice::scheduleReconnect()
+{
+    if (d->parentModel && d->parentModel->appSettings() && !d->parentModel->appSettings()->autoReconnect()) {
+        return;
+    }
+    if (d->reconnectTimer.isActive()) {
+        // We already have an attempt lined up, and a single failure may well be reported more than once
+        return;
+    }
+    const ReconnectState newState = (d->reconnectAttempts < Private::reconnectBackoffAttempts) ? BackingOff : LowDutyCycle;
+    if (newState == LowDutyCycle && d->reconnectState != LowDutyCycle) {
+        emit deviceMessage(deviceID(), QString("Could not reconnect to %1 (%2) so far. To connect to it, please check that it is on, charged, and near enough. We will keep trying every few minutes, and straight away if it is seen again.").arg(name()).arg(deviceID()));
+    } else if (d->reconnectState == NotReconnecting) {
+        qDebug() << name() << deviceID() << "Connection lost - attempting to reconnect.";
+        emit deviceMessage(deviceID(), QString("Connection lost to %1, attempting to reconnect...").arg(name()));
+    }
+    d->reconnectState = newState;
+    const int delay = d->reconnectDelay();
+    // Long waits don't need to be precise, and letting the system batch them up saves battery
+    d->reconnectTimer.setTimerType(newState == LowDutyCycle ? Qt::VeryCoarseTimer : Qt::CoarseTimer);
+    d->reconnectTimer.start(delay);
+    d->nextReconnectAttempt = QDateTime::currentMSecsSinceEpoch() + delay;
+    emit reconnectStateChanged();
+}
+
+void BTDevice::reconnectSucceeded()
+{
+    cancelReconnect();
+}
+
+void BTDevice::cancelReconnect()
+{
+    d->reconnectTimer.stop();
+    if (d->reconnectState != NotReconnecting || d->reconnectAttempts > 0) {
+        d->reconnectState = NotReconnecting;
+        d->reconnectAttempts = 0;
+        d->nextReconnectAttempt = 0;
+        emit reconnectStateChanged();
+    }
+}
+
+void BTDevice::attemptReconnect()
+{
+    connectDevice();
+}
+
 QStringList BTDevice::enabledCommandsFiles() const
 {
     return d->enabledCommandsFiles;
@@ -132,23 +300,24 @@ void BTDevice::setCommandsFileEnabledState(const QString& filename, bool enabled
 void BTDevice::reloadCommands() {
     commandModel->clear();
     commandShorthands.clear();
-    QVariantMap commandFiles = d->parentModel->appSettings()->commandFiles();
+    AppSettings* appSettings = d->parentModel->appSettings();
     // If there are no enabled files, we'll load the default, so we don't end up with no commands at all
     QStringList enabledFiles = d->enabledCommandsFiles.count() > 0 ? d->enabledCommandsFiles : defaultCommandFiles();
     for (const QString& enabledFile : enabledFiles) {
-        QVariantMap file = commandFiles[enabledFile].toMap();
-        CommandPersistence persistence;
-        persistence.deserialize(file[QLatin1String{"contents"}].toString());
-        if (persistence.error().isEmpty()) {
-            for (const CommandInfo &command : persistence.commands()) {
-                commandModel->addCommand(command);
-            }
-            for (const CommandShorthand& shorthand : persistence.shorthands()) {
-                commandShorthands[shorthand.command] = shorthand.expansion.join(QChar{';'});
+        // The catalogue's lists are shared between all the devices with the same files enabled
+        const CommandCatalogue::File file = CommandCatalogue::getInstance()->file(enabledFile, appSettings);
+        if (file.error.isEmpty()) {
+            commandModel->addCommands(file.commands);
+            if (commandShorthands.isEmpty()) {
+                commandShorthands = file.shorthands;
+            } else {
+                for (QMap<QString, QString>::const_iterator it = file.shorthands.cbegin(); it != file.shorthands.cend(); ++it) {
+                    commandShorthands[it.key()] = it.value();
+                }
             }
         }
         else {
-            qWarning() << "Failure in loading the commands data for" << enabledFile << "with the error:" << persistence.error();
+            qWarning() << "Failure in loading the commands data for" << enabledFile << "with the error:" << file.error;
         }
     }
 }
@@ -38,10 +38,20 @@ class BTDevice : public QObject
     Q_PROPERTY(int batteryLevel READ batteryLevel NOTIFY batteryLevelChanged)
     Q_PROPERTY(QString deviceID READ deviceID CONSTANT)
     Q_PROPERTY(QStringList enabledCommandsFiles READ enabledCommandsFiles NOTIFY enabledCommandsFilesChanged)
+    Q_PROPERTY(int roundTripTime READ roundTripTime NOTIFY roundTripTimeChanged)
+    Q_PROPERTY(ReconnectState reconnectState READ reconnectState NOTIFY reconnectStateChanged)
+    Q_PROPERTY(qint64 nextReconnectAttempt READ nextReconnectAttempt NOTIFY reconnectStateChanged)
 public:
     explicit BTDevice(const QBluetoothDeviceInfo& info, BTDeviceModel* parent = nullptr);
     ~BTDevice() override;
 
+    enum ReconnectState {
+        NotReconnecting = 0, ///< The device is either connected, or we are not trying to reconnect to it
+        BackingOff, ///< Trying to reconnect, waiting a little longer after each failed attempt
+        LowDutyCycle ///< Reconnecting failed for a while, so we only try once every few minutes
+    };
+    Q_ENUM(ReconnectState)
+
     QBluetoothDeviceInfo deviceInfo;
 
     TailCommandModel* commandModel{new TailCommandModel(this)};
@@ -85,6 +95,76 @@ public:
     virtual void sendMessage(const QString &message) = 0;
 
     Q_SIGNAL void deviceMessage(const QString& deviceID, const QString& message);
+
+    /**
+     * The smoothed time (in milliseconds) from sending a message to the device, until
+     * receiving its response, measured using the device's keepalive exchanges (such as
+     * BATT on the tail, and PING on the ears), or -1 if there is no measurement yet.
+     */
+    int roundTripTime() const;
+    Q_SIGNAL void roundTripTimeChanged(int roundTripTime);
+    /**
+     * The estimated time (in milliseconds) from sending a message, until the device
+     * acts on it, that is, the offset between our clock and when the device sees things.
+     * This is half the round trip time, or 0 if there is no measurement yet.
+     */
+    int oneWayDelay() const;
+
+    /**
+     * Where the device is in the process of reconnecting after losing its connection
+     */
+    ReconnectState reconnectState() const;
+    /**
+     * The number of reconnection attempts made since the connection was lost
+     */
+    int reconnectAttempts() const;
+    /**
+     * When the next reconnection attempt will be made, in milliseconds since the
+     * unix epoch, or 0 if no attempt is scheduled
+     */
+    qint64 nextReconnectAttempt() const;
+    Q_SIGNAL void reconnectStateChanged();
+    /**
+     * Call when the device has been seen in discovery. If we are waiting to reconnect
+     * to the device, this means it is likely available again, so instead of waiting for
+     * the next scheduled attempt, we try straight away. This is only done if no attempt
+     * is currently under way, and at most once every ten seconds, and it does not reset
+     * the backoff, so a device which keeps advertising but can't be connected to still
+     * ends up being tried only every so often.
+     */
+    void deviceSeen();
+    /**
+     * Stop trying to reconnect (for example when the user asks for the device to be disconnected)
+     */
+    void cancelReconnect();
+protected:
+    /**
+     * Call when the connection was lost or could not be established, to schedule
+     * an attempt to reconnect. The first few attempts are made in quick succession,
+     * and then with exponentially longer (and randomly jittered) waits between
+     * them, until finally settling on one attempt every few minutes, indefinitely.
+     * If auto reconnection is disabled in the settings, this does nothing.
+     */
+    void scheduleReconnect();
+    /**
+     * Call when the connection has been fully established, to reset the reconnection state
+     */
+    void reconnectSucceeded();
+    /**
+     * Make an attempt at reconnecting to the device. The default implementation
+     * calls connectDevice().
+     */
+    virtual void attemptReconnect();
+
+    /**
+     * Call when sending a message whose response is used to measure the round trip time
+     */
+    void startRoundTrip();
+    /**
+     * Call when receiving the response to the message sent after calling startRoundTrip().
+     * If startRoundTrip() has not been called since the last response, this does nothing.
+     */
+    void endRoundTrip();
 private:
     class Private;
     Private* d;
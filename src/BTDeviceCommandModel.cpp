@@ -22,6 +22,7 @@
 #include "TailCommandModel.h"
 #include "CommandInfo.h"
 #include <QRandomGenerator>
+#include <QSet>
 
 class BTDeviceCommandModel::Private
 {
@@ -36,139 +37,273 @@ public:
         ~Entry() { }
         CommandInfo command;
         QList<BTDevice*> devices;
+        int row{-1};
+
+        // The aggregated state is kept as a count of the devices on which this command is
+        // running or available, updated from the changes on each device as they happen,
+        // so we never have to go back and ask every device about their state again.
+        enum DeviceState {
+            NoState = 0,
+            Running = 1,
+            Available = 2
+        };
+        QHash<BTDevice*, int> deviceStates;
+        int runningCount{0};
+        int availableCount{0};
+
+        // Returns the roles which changed in the aggregated state (if any)
+        QVector<int> setDeviceState(BTDevice* device, int state) {
+            QVector<int> changedRoles;
+            const int oldState = deviceStates.value(device, NoState);
+            if (oldState != state) {
+                runningCount += ((state & Running) ? 1 : 0) - ((oldState & Running) ? 1 : 0);
+                availableCount += ((state & Available) ? 1 : 0) - ((oldState & Available) ? 1 : 0);
+                if (command.isRunning != (runningCount > 0)) {
+                    command.isRunning = (runningCount > 0);
+                    changedRoles << BTDeviceCommandModel::IsRunning;
+                }
+                if (command.isAvailable != (availableCount > 0)) {
+                    command.isAvailable = (availableCount > 0);
+                    changedRoles << BTDeviceCommandModel::IsAvailable;
+                }
+            }
+            deviceStates[device] = state;
+            return changedRoles;
+        }
+
+        QVector<int> removeDevice(BTDevice* device) {
+            QVector<int> changedRoles = setDeviceState(device, NoState);
+            deviceStates.remove(device);
+            devices.removeAll(device);
+            return changedRoles;
+        }
     };
     QVector<Entry*> commands;
+    // Lookup tables for the entries, by their command and by their category, each
+    // list kept in the same order as the entries appear in the model
+    QHash<QString, QVector<Entry*>> commandIndex;
+    QHash<QString, QVector<Entry*>> categoryIndex;
 
-    void addCommand(const CommandInfo& command, BTDevice* device) {
-        Entry* entry{nullptr};
-        // check if command already exists in some entry
-        for (Entry* existing : commands) {
-            if (existing->command.compare(command)) {
-                entry = existing;
-                break;
+    void indexEntry(Entry* entry) {
+        commandIndex[entry->command.command] << entry;
+        categoryIndex[entry->command.category] << entry;
+    }
+
+    void unindexEntry(Entry* entry) {
+        QHash<QString, QVector<Entry*>>::iterator it = commandIndex.find(entry->command.command);
+        if (it != commandIndex.end()) {
+            it.value().removeOne(entry);
+            if (it.value().isEmpty()) {
+                commandIndex.erase(it);
+            }
+        }
+        it = categoryIndex.find(entry->command.category);
+        if (it != categoryIndex.end()) {
+            it.value().removeOne(entry);
+            if (it.value().isEmpty()) {
+                categoryIndex.erase(it);
             }
         }
+    }
+
+    Entry* findEntry(const CommandInfo& command) const {
+        QHash<QString, QVector<Entry*>>::const_iterator it = commandIndex.constFind(command.command);
+        if (it != commandIndex.constEnd()) {
+            for (Entry* existing : it.value()) {
+                if (existing->command.compare(command)) {
+                    return existing;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    // The state of a command on a specific device, given the state the device's model has for it
+    static int deviceState(BTDevice* device, const CommandInfo& command, bool isRunning, bool isAvailable) {
+        int state{Entry::NoState};
+        if (isRunning) {
+            state |= Entry::Running;
+        }
+        // TAILHM is always available (see TailCommandModel::isAvailable)
+        if (device->isConnected() && (isAvailable || command.command == QLatin1String{"TAILHM"})) {
+            state |= Entry::Available;
+        }
+        return state;
+    }
+
+    void updateRows(int first) {
+        for (int i = first; i < commands.count(); ++i) {
+            commands[i]->row = i;
+        }
+    }
+
+    void addCommand(const CommandInfo& command, BTDevice* device, int state) {
+        // check if command already exists in some entry
+        Entry* entry = findEntry(command);
         // if not, create a new entry and store the command in it
         if (!entry) {
             entry = new Entry(command);
+            // The aggregated state is built up from the devices' states, starting from nothing
+            entry->command.isRunning = false;
+            entry->command.isAvailable = false;
+            entry->devices << device;
+            entry->setDeviceState(device, state);
             q->beginInsertRows(QModelIndex(), commands.count(), commands.count());
+            entry->row = commands.count();
             commands << entry;
+            indexEntry(entry);
             q->endInsertRows();
+            return;
         }
         // add device to entry (shouldn't really be possible for this to happen twice, but...)
         if (!entry->devices.contains(device)) {
             entry->devices << device;
         }
+        const QVector<int> changedRoles = entry->setDeviceState(device, state);
+        if (!changedRoles.isEmpty()) {
+            q->dataChanged(q->index(entry->row), q->index(entry->row), changedRoles);
+        }
     }
 
-    void removeCommand(const CommandInfo& command, BTDevice* device) {
-        Entry* entry{nullptr};
-        // check if command exists
-        for (Entry* existing : commands) {
-            if (existing->command.compare(command)) {
-                entry = existing;
-                break;
+    // Add a whole list of commands from a device in one go, with all the new entries
+    // inserted as a single range, and the changes to existing entries reported as one
+    void addCommands(const CommandInfoList& newCommands, BTDevice* device) {
+        QVector<Entry*> added;
+        QVector<int> changedRoles;
+        int firstChanged{commands.count()};
+        int lastChanged{-1};
+        for (const CommandInfo& command : newCommands) {
+            const int state = deviceState(device, command, command.isRunning, command.isAvailable);
+            Entry* entry = findEntry(command);
+            if (!entry) {
+                entry = new Entry(command);
+                entry->command.isRunning = false;
+                entry->command.isAvailable = false;
+                entry->devices << device;
+                entry->setDeviceState(device, state);
+                // Index it straight away, so duplicates further down the list find it
+                indexEntry(entry);
+                added << entry;
+                continue;
+            }
+            if (!entry->devices.contains(device)) {
+                entry->devices << device;
+            }
+            const QVector<int> entryRoles = entry->setDeviceState(device, state);
+            // Entries added in this pass have no row yet, and will be inserted with their final state
+            if (!entryRoles.isEmpty() && entry->row > -1) {
+                firstChanged = qMin(firstChanged, entry->row);
+                lastChanged = qMax(lastChanged, entry->row);
+                for (int role : entryRoles) {
+                    if (!changedRoles.contains(role)) {
+                        changedRoles << role;
+                    }
+                }
             }
         }
+        if (lastChanged > -1) {
+            q->dataChanged(q->index(firstChanged), q->index(lastChanged), changedRoles);
+        }
+        if (!added.isEmpty()) {
+            q->beginInsertRows(QModelIndex(), commands.count(), commands.count() + added.count() - 1);
+            for (Entry* entry : qAsConst(added)) {
+                entry->row = commands.count();
+                commands << entry;
+            }
+            q->endInsertRows();
+        }
+    }
+
+    // Remove the rows from first to last (inclusive), and delete their entries
+    void removeRows(int first, int last) {
+        q->beginRemoveRows(QModelIndex(), first, last);
+        for (int i = first; i <= last; ++i) {
+            unindexEntry(commands.at(i));
+            delete commands.at(i);
+        }
+        commands.remove(first, last - first + 1);
+        q->endRemoveRows();
+    }
+
+    void removeCommand(const CommandInfo& command, BTDevice* device) {
+        // check if command exists
+        Entry* entry = findEntry(command);
         // if command exists in some entry, remove device from it
         if (entry) {
-            if (entry->devices.contains(device)) {
-                entry->devices.removeAll(device);
-            }
+            const QVector<int> changedRoles = entry->removeDevice(device);
             // if there are no more devices in that command, remove the entry
             if (entry->devices.count() == 0) {
-                const int position = commands.indexOf(entry);
-                q->beginRemoveRows(QModelIndex(), position, position);
-                commands.remove(position);
-                q->endRemoveRows();
-                delete entry;
+                const int position = entry->row;
+                removeRows(position, position);
+                updateRows(position);
+            } else if (!changedRoles.isEmpty()) {
+                q->dataChanged(q->index(entry->row), q->index(entry->row), changedRoles);
             }
         }
     }
 
     void addDeviceCommands(BTDevice* device) {
         TailCommandModel* deviceCommands = device->commandModel;
-        for (const CommandInfo& command : deviceCommands->allCommands()) {
-            addCommand(command, device);
+        for (int i = 0; i < deviceCommands->rowCount(); ++i) {
+            const CommandInfo& command = deviceCommands->commandAt(i);
+            addCommand(command, device, deviceState(device, command, deviceCommands->isRunningAt(i), deviceCommands->isAvailableAt(i)));
         }
     }
 
     void removeDeviceCommands(BTDevice* device) {
-        q->beginResetModel();
-        QMutableVectorIterator<Entry*> it(commands);
-        while (it.hasNext()) {
-            it.next();
-            // Remove mention of device if it exists in an entry
-            if (it.value()->devices.contains(device)) {
-                it.value()->devices.removeAll(device);
-                // If entry is now empty of devices, remove and delete it
-                if (it.value()->devices.count() == 0) {
-                    delete it.value();
-                    it.remove();
+        // Rather than resetting the model (which would cause any replica to fetch every
+        // row again), remove only the entries which no longer have any devices, one run
+        // of contiguous rows at a time. We walk backwards, so that removing a run does not
+        // move any of the rows we have yet to look at.
+        int runEnd{-1};
+        int firstRemoved{-1};
+        for (int i = commands.count() - 1; i >= 0; --i) {
+            Entry* entry = commands.at(i);
+            bool removeEntry{false};
+            if (entry->deviceStates.contains(device)) {
+                const QVector<int> changedRoles = entry->removeDevice(device);
+                if (entry->devices.count() == 0) {
+                    removeEntry = true;
+                } else if (!changedRoles.isEmpty()) {
+                    q->dataChanged(q->index(i), q->index(i), changedRoles);
+                }
+            }
+            if (removeEntry) {
+                if (runEnd == -1) {
+                    runEnd = i;
                 }
+                firstRemoved = i;
+            } else if (runEnd > -1) {
+                removeRows(i + 1, runEnd);
+                runEnd = -1;
             }
         }
-        q->endResetModel();
+        if (runEnd > -1) {
+            removeRows(0, runEnd);
+        }
+        if (firstRemoved > -1) {
+            updateRows(firstRemoved);
+        }
     }
 
     void deviceDataChanged(BTDevice* device, const QModelIndex& topLeft, const QModelIndex& bottomRight, const QVector< int >& roles) {
+        if (!roles.isEmpty() && !roles.contains(TailCommandModel::IsRunning) && !roles.contains(TailCommandModel::IsAvailable)) {
+            // Nothing we aggregate has changed
+            return;
+        }
+        // The device's model only tells us about the rows which actually changed (see TailCommandModel::setRunning),
+        // so this is only ever a handful of rows, not the whole model
         TailCommandModel* deviceCommands = device->commandModel;
-        int first = topLeft.row();
-        int last = bottomRight.row();
-        int i = -1;
-        for (const CommandInfo& cmd : deviceCommands->allCommands()) {
-            ++i;
-            if (i < first) { continue; }
-            if (i > last) { break; }
-            Entry* theEntry{nullptr};
-            int entryIdx{-1};
-            for (Entry* entry : commands) {
-                ++entryIdx;
-                if (entry->command.compare(cmd) && entry->devices.contains(device)) {
-                    theEntry = entry;
-//                     qDebug() << "Found the entry which has the same command" << theEntry;
-                    break;
-                }
-            }
-            if (theEntry) {
-                QVector<int> theRoles = roles;
-                QVector<int> ourRoles;
-                if (roles.length() == 0) {
-                    // this would want commenting back in when there's things other than IsRunning to worry about,
-                    // such as the future IsAvailable field (for a less obstructive "you can't run this command
-                    // now" method that is less app-blocky)
-                    theRoles = q->roleNames().keys().toVector();
-//                     theRoles << TailCommandModel::IsRunning;
+        const int last = qMin(bottomRight.row(), deviceCommands->rowCount() - 1);
+        for (int i = qMax(0, topLeft.row()); i <= last; ++i) {
+            const CommandInfo& cmd = deviceCommands->commandAt(i);
+            Entry* theEntry = findEntry(cmd);
+            if (theEntry && theEntry->deviceStates.contains(device)) {
+                // Only the device which changed has to be looked at, the others' states are already counted
+                const QVector<int> changedRoles = theEntry->setDeviceState(device, deviceState(device, cmd, deviceCommands->isRunningAt(i), deviceCommands->isAvailableAt(i)));
+                if (!changedRoles.isEmpty()) {
+                    q->dataChanged(q->index(theEntry->row), q->index(theEntry->row), changedRoles);
                 }
-                for (int role : theRoles) {
-//                     qDebug() << "The role which changed was" << role;
-                    if (role == TailCommandModel::IsRunning) {
-                        // we've got something we care about, let's deal with it
-                        bool anyRunning{false};
-                        for (BTDevice* aDevice : theEntry->devices) {
-                            anyRunning = aDevice->commandModel->isRunning(cmd);
-                            if (anyRunning) {
-                                break;
-                            }
-                        }
-                        theEntry->command.isRunning = anyRunning;
-                        ourRoles << BTDeviceCommandModel::IsRunning;
-                    } else if (role == TailCommandModel::IsAvailable) {
-                        // we've got something we care about, let's deal with it
-                        bool anyAvailable{false};
-                        for (BTDevice* aDevice : theEntry->devices) {
-                            if (aDevice->isConnected()) {
-                                anyAvailable = aDevice->commandModel->isAvailable(cmd);
-                                if (anyAvailable) {
-                                    break;
-                                }
-                            }
-                        }
-                        theEntry->command.isAvailable = anyAvailable;
-                        ourRoles << BTDeviceCommandModel::IsAvailable;
-                    }
-                }
-                q->dataChanged(q->index(entryIdx), q->index(entryIdx), ourRoles);
             } else {
                 qDebug() << "Something broke, and we got a data changed signal for something with no equivalent Entry..." << device << cmd.command;
             }
@@ -177,7 +312,8 @@ public:
 
     void registerDevice(BTDevice* device) {
         TailCommandModel* deviceCommands = device->commandModel;
-        QObject::connect(deviceCommands, &TailCommandModel::commandAdded, q, [this, device](const CommandInfo& command){ addCommand(command, device); });
+        QObject::connect(deviceCommands, &TailCommandModel::commandAdded, q, [this, device](const CommandInfo& command){ addCommand(command, device, deviceState(device, command, command.isRunning, command.isAvailable)); });
+        QObject::connect(deviceCommands, &TailCommandModel::commandsAdded, q, [this, device](const CommandInfoList& commands){ addCommands(commands, device); });
         QObject::connect(deviceCommands, &TailCommandModel::commandRemoved, q, [this, device](const CommandInfo& command){ removeCommand(command, device); });
         QObject::connect(deviceCommands, &QAbstractListModel::modelAboutToBeReset, q, [this, device](){ removeDeviceCommands(device); });
         QObject::connect(deviceCommands, &QAbstractListModel::modelReset, q, [this, device](){ addDeviceCommands(device); });
@@ -296,31 +432,52 @@ CommandInfo BTDeviceCommandModel::getCommand(int index) const
 
 CommandInfo BTDeviceCommandModel::getCommand(QString command) const
 {
+    const CommandInfo* found = findCommand(command);
+    if (found) {
+        return *found;
+    }
     CommandInfo cmd;
     // Just in case - this is specifically for TAILHM, which must exist (and
     // preparing for others that are the same, but basically that - these are
     // commands which are technically invalid, but always available)
     cmd.command = command;
-    for(Private::Entry* current : d->commands) {
-        if(current->command.command == command) {
-            cmd = current->command;
-            break;
-        }
-    }
     return cmd;
 }
 
+const CommandInfo* BTDeviceCommandModel::findCommand(const QString& command) const
+{
+    QHash<QString, QVector<Private::Entry*>>::const_iterator it = d->commandIndex.constFind(command);
+    if (it != d->commandIndex.constEnd()) {
+        return &it.value().first()->command;
+    }
+    return nullptr;
+}
+
 CommandInfo BTDeviceCommandModel::getRandomCommand(QStringList includedCategories) const
 {
     if(d->commands.count() > 0) {
-        CommandInfoList pickFrom;
-        for(Private::Entry* current : d->commands) {
-            if(includedCategories.isEmpty() || includedCategories.contains(current->command.category)) {
-                pickFrom << current->command;
+        if (includedCategories.isEmpty()) {
+            return d->commands.at(QRandomGenerator::global()->bounded(d->commands.count()))->command;
+        }
+        // Pick from the union of the commands in the included categories, so every command is equally
+        // likely to be picked, however many times its category was asked for, and even if it is
+        // in more than one of the categories (which each have their own entry for it)
+        includedCategories.removeDuplicates();
+        QVector<const Private::Entry*> candidates;
+        QSet<QString> seen;
+        for (const QString& category : qAsConst(includedCategories)) {
+            QHash<QString, QVector<Private::Entry*>>::const_iterator it = d->categoryIndex.constFind(category);
+            if (it != d->categoryIndex.constEnd()) {
+                for (const Private::Entry* entry : it.value()) {
+                    if (!seen.contains(entry->command.command)) {
+                        seen.insert(entry->command.command);
+                        candidates << entry;
+                    }
+                }
             }
         }
-        if (pickFrom.count() > 0) {
-            return pickFrom.at(QRandomGenerator::global()->bounded(pickFrom.count()));
+        if (!candidates.isEmpty()) {
+            return candidates.at(QRandomGenerator::global()->bounded(candidates.count()))->command;
         }
         qWarning() << "We have no commands to pick from - maybe we should inform the user of this...";
     }
@@ -69,10 +69,23 @@ public:
      * @return The command info instance for the specified command, or null if none was found
      */
     Q_INVOKABLE CommandInfo getCommand(QString command) const;
+    /**
+     * Find the command with the specified actual command, without copying it
+     *
+     * Unlike getCommand(QString), this will not give you a stand-in for commands
+     * which are not in the model.
+     * @note The returned instance is owned by the model, and is only valid until
+     * the model next changes, so do not hold on to it.
+     *
+     * @param command The command to fetch information for
+     * @return The command info instance for the specified command, or null if none was found
+     */
+    const CommandInfo* findCommand(const QString& command) const;
     /**
      * Get a random command, picked from the currently available commands, limited
      * to commands with the category listed in includedCategories. If the list is
-     * empty, any command will be listed.
+     * empty, any command will be listed. Each command is equally likely to be picked,
+     * even if it is in more than one of the included categories.
      *
      * @param includedCategories A list of strings matching the categories
      * @return A random command matching one of the requested categories
@@ -22,6 +22,8 @@
 #include <QTimer>
 
 #include "AppSettings.h"
+#include "CommandLatency.h"
+#include "GattLayoutCache.h"
 
 class BTDeviceEars::Private {
 public:
@@ -41,6 +43,11 @@ public:
     QString currentSubCall;
     QStringList callQueue;
 
+    // The command we are tracking the latency of (see CommandLatency), which may be sent
+    // to the ears in several parts, and the first part of it, which is what gets written
+    QString latencyCommand;
+    QByteArray latencyFirstCall;
+
     QLowEnergyController* btControl{nullptr};
     QLowEnergyService* earsService{nullptr};
     QLowEnergyCharacteristic earsCommandWriteCharacteristic;
@@ -50,34 +57,45 @@ public:
     QLowEnergyCharacteristic batteryCharacteristic;
 
     QTimer pingTimer;
+    QBluetoothUuid earsServiceUuid{QLatin1String("{927dee04-ddd4-4582-8e42-69dc9fbfae66}")};
     QBluetoothUuid earsCommandWriteCharacteristicUuid{QLatin1String("{05e026d8-b395-4416-9f8a-c00d6c3781b9}")};
     QBluetoothUuid earsCommandReadCharacteristicUuid{QLatin1String("{0b646a19-371e-4327-b169-9632d56c0e84}")};
 
-    int reconnectThrottle{0};
-    void reconnectDevice(QObject* context)
-    {
-        QTimer::singleShot(0, context, [this] {
-            if (btControl) {
-                if (reconnectThrottle > 10) {
-                    q->disconnectDevice();
-                    reconnectThrottle = 0;
-                    q->deviceMessage(q->deviceID(), QString("Attempted to reconnect too many times to %1 (%2). To connect to it, please check that it is on, charged, and near enough.").arg(q->name()).arg(q->deviceID()));
-                    return;
-                }
-                qDebug() << q->name() << q->deviceID() << "Connection lost - attempting to reconnect.";
-                q->deviceMessage(q->deviceID(), QString("Connection lost to %1, attempting to reconnect...").arg(q->name()));
-                ++reconnectThrottle;
-                btControl->connectToDevice();
-            }
-        });
-    }
-
     void connectToDevice()
     {
         qDebug() << q->name() << q->deviceID() << "Attempting to connect to device";
         q->connectDevice();
     }
 
+    // Whether we knew the layout of the main ears service when starting to connect. If we did, we
+    // set up the service as soon as the controller finds it, rather than waiting for it to finish
+    // discovering everything else first, skip reading the values of everything in it, and skip
+    // logging all the details again.
+    bool usingCachedLayout{false};
+    // When using the cached layout, the battery service is only discovered once the main service
+    // is ready for use, so the two don't compete for the connection
+    bool earsServiceReady{false};
+    bool batteryDiscoveryPending{false};
+
+    void discoverBatteryService()
+    {
+        batteryDiscoveryPending = false;
+        GattLayoutCache::discoverDetails(batteryService, GattLayoutCache::getInstance()->hasLayout(q->deviceID(), QBluetoothUuid(QBluetoothUuid::BatteryService)));
+    }
+
+    bool createEarsService()
+    {
+        earsService = btControl->createServiceObject(earsServiceUuid);
+        if (!earsService) {
+            return false;
+        }
+        QObject::connect(earsService, &QLowEnergyService::stateChanged, q, [this](QLowEnergyService::ServiceState newState){ serviceStateChanged(newState); });
+        QObject::connect(earsService, &QLowEnergyService::characteristicChanged, q, [this](const QLowEnergyCharacteristic& info, const QByteArray& value){ characteristicChanged(info, value); });
+        QObject::connect(earsService, &QLowEnergyService::characteristicWritten, q, [this](const QLowEnergyCharacteristic& info, const QByteArray& value){ characteristicWritten(info, value); });
+        GattLayoutCache::discoverDetails(earsService, usingCachedLayout);
+        return true;
+    }
+
     void serviceStateChanged(QLowEnergyService::ServiceState s)
     {
         switch (s) {
@@ -88,8 +106,17 @@ public:
         {
             qDebug() << q->name() << q->deviceID() << "Service discovered.";
 
-            foreach(const QLowEnergyCharacteristic& leChar, earsService->characteristics()) {
-                qDebug() << q->name() << q->deviceID() << "Characteristic:" << leChar.name() << leChar.uuid() << leChar.properties();
+            GattLayoutCache* layoutCache = GattLayoutCache::getInstance();
+            if (usingCachedLayout && layoutCache->matches(q->deviceID(), earsService)) {
+                qDebug() << q->name() << q->deviceID() << "Service layout matches the cached one";
+            } else {
+                if (usingCachedLayout) {
+                    qDebug() << q->name() << q->deviceID() << "Service layout does not match the cached one, using the newly discovered layout";
+                    usingCachedLayout = false;
+                }
+                foreach(const QLowEnergyCharacteristic& leChar, earsService->characteristics()) {
+                    qDebug() << q->name() << q->deviceID() << "Characteristic:" << leChar.name() << leChar.uuid() << leChar.properties();
+                }
             }
 
             earsCommandWriteCharacteristic = earsService->characteristic(earsCommandWriteCharacteristicUuid);
@@ -114,7 +141,15 @@ public:
             QLowEnergyDescriptor earsDescriptor = earsCommandReadCharacteristic.descriptor(QBluetoothUuid::ClientCharacteristicConfiguration);
             earsService->writeDescriptor(earsDescriptor, QByteArray::fromHex("0100"));
 
-            reconnectThrottle = 0;
+            if (!usingCachedLayout) {
+                layoutCache->store(q->deviceID(), earsService);
+            }
+            CommandLatency::getInstance()->connectionReady(q->deviceID(), usingCachedLayout);
+            earsServiceReady = true;
+            if (batteryDiscoveryPending) {
+                discoverBatteryService();
+            }
+            q->reconnectSucceeded();
             emit q->isConnectedChanged(q->isConnected());
             q->sendMessage("VER"); // Ask for the version, and then react to the response...
 
@@ -146,6 +181,7 @@ public:
                 q->reloadCommands();
                 version = newValue;
                 emit q->versionChanged(newValue);
+                GattLayoutCache::getInstance()->setFirmware(q->deviceID(), version);
                 q->setListenMode(listenMode);
                 pingTimer.start();
             }
@@ -153,6 +189,7 @@ public:
                 if (currentCall != QLatin1String{"PING"}) {
                     qWarning() << q->name() << q->deviceID() << "We got an out-of-order response for a ping";
                 }
+                q->endRoundTrip();
             }
             else if (theValue == QLatin1String{"EarGear started"}) {
                 qDebug() << q->name() << q->deviceID() << "EarGear box detected the connection";
@@ -182,6 +219,9 @@ public:
             }
             else if (stateResult.last() == QLatin1String{"BEGIN"}) {
                 q->commandModel->setRunning(currentCall, true);
+                if (!latencyCommand.isEmpty()) {
+                    CommandLatency::getInstance()->commandBegan(q->deviceID(), latencyCommand);
+                }
                 // ****************************************************
                 // ******************* EARLY RETURN *******************
                 // ****************************************************
@@ -216,6 +256,10 @@ public:
                 } else {
                     // If the queue is empty, we're done
                     q->commandModel->setRunning(currentCall, false);
+                    if (!latencyCommand.isEmpty()) {
+                        CommandLatency::getInstance()->commandEnded(q->deviceID(), latencyCommand);
+                        latencyCommand.clear();
+                    }
                 }
             }
             else if (theValue == QLatin1String{"Mics auto balance completed"}) {
@@ -242,6 +286,11 @@ public:
     {
         qDebug() << q->name() << q->deviceID() << "Characteristic written:" << characteristic.uuid() << newValue;
         currentCall = newValue;
+        if (!latencyFirstCall.isEmpty() && newValue == latencyFirstCall) {
+            CommandLatency::getInstance()->commandWritten(q->deviceID(), latencyCommand);
+            // Only the first write counts (we may write the same again if the ears are busy)
+            latencyFirstCall.clear();
+        }
         emit q->currentCallChanged(currentCall);
     }
 };
@@ -276,15 +325,25 @@ void BTDeviceEars::connectDevice()
 
     d->btControl = QLowEnergyController::createCentral(deviceInfo, this);
     d->btControl->setRemoteAddressType(QLowEnergyController::RandomAddress);
+    QLowEnergyController* controller = d->btControl;
 
     if(d->earsService) {
         d->earsService->deleteLater();
         d->earsService = nullptr;
     }
 
+    CommandLatency::getInstance()->connectionStarted(deviceID());
+    d->usingCachedLayout = GattLayoutCache::getInstance()->hasLayout(deviceID(), d->earsServiceUuid);
+    d->earsServiceReady = false;
+    d->batteryDiscoveryPending = false;
+
     connect(d->btControl, &QLowEnergyController::serviceDiscovered,
         [this](const QBluetoothUuid &gatt){
             qDebug() << name() << deviceID() << "service discovered" << gatt;
+            if (d->usingCachedLayout && gatt == d->earsServiceUuid && !d->earsService) {
+                // If this doesn't work out yet, we will try again once discovery is finished
+                d->createEarsService();
+            }
         });
 
     connect(d->btControl, &QLowEnergyController::discoveryFinished,
@@ -292,19 +351,13 @@ void BTDeviceEars::connectDevice()
                 qDebug() << name() << deviceID()<< "Done!";
 
                 // Main control service
-                d->earsService = d->btControl->createServiceObject(QBluetoothUuid(QLatin1String("{927dee04-ddd4-4582-8e42-69dc9fbfae66}")));
-                if (!d->earsService) {
-                    qWarning() << "Cannot create QLowEnergyService for {927dee04-ddd4-4582-8e42-69dc9fbfae66}";
+                if (!d->earsService && !d->createEarsService()) {
+                    qWarning() << "Cannot create QLowEnergyService for" << d->earsServiceUuid;
                     emit deviceMessage(deviceID(), QLatin1String("An error occurred while connecting to your EarGear box (the main service object could not be created). If you feel this is in error, please try again!"));
                     disconnectDevice();
                     return;
                 }
 
-                connect(d->earsService, &QLowEnergyService::stateChanged, this, [this](QLowEnergyService::ServiceState newState){ d->serviceStateChanged(newState); });
-                connect(d->earsService, &QLowEnergyService::characteristicChanged, this, [this](const QLowEnergyCharacteristic& info, const QByteArray& value){ d->characteristicChanged(info, value); });
-                connect(d->earsService, &QLowEnergyService::characteristicWritten, this, [this](const QLowEnergyCharacteristic& info, const QByteArray& value){ d->characteristicWritten(info, value); });
-                d->earsService->discoverDetails();
-
                 // Battery service
                 d->batteryService = d->btControl->createServiceObject(QBluetoothUuid::BatteryService);
                 if (!d->batteryService) {
@@ -331,8 +384,13 @@ void BTDeviceEars::connectDevice()
                         {
                             qDebug() << name() << deviceID() << "Battery service discovered";
 
-                            foreach(const QLowEnergyCharacteristic& leChar, d->batteryService->characteristics()) {
-                                qDebug() << name() << deviceID() << "Characteristic:" << leChar.name() << leChar.uuid() << leChar.properties();
+                            if (GattLayoutCache::getInstance()->matches(deviceID(), d->batteryService)) {
+                                qDebug() << name() << deviceID() << "Battery service layout matches the cached one";
+                            } else {
+                                foreach(const QLowEnergyCharacteristic& leChar, d->batteryService->characteristics()) {
+                                    qDebug() << name() << deviceID() << "Characteristic:" << leChar.name() << leChar.uuid() << leChar.properties();
+                                }
+                                GattLayoutCache::getInstance()->store(deviceID(), d->batteryService);
                             }
 
                             d->batteryCharacteristic = d->batteryService->characteristic(QBluetoothUuid::BatteryLevel);
@@ -358,7 +416,11 @@ void BTDeviceEars::connectDevice()
                             break;
                         }
                     });
-                    d->batteryService->discoverDetails();
+                    if (d->usingCachedLayout && !d->earsServiceReady) {
+                        d->batteryDiscoveryPending = true;
+                    } else {
+                        d->discoverBatteryService();
+                    }
                 }
             });
 
@@ -380,10 +442,9 @@ void BTDeviceEars::connectDevice()
                     break;
             }
 
+            disconnectDevice();
             if (d->parentModel->appSettings()->autoReconnect()) {
-                d->reconnectDevice(this);
-            } else {
-                disconnectDevice();
+                scheduleReconnect();
             }
         });
 
@@ -392,10 +453,17 @@ void BTDeviceEars::connectDevice()
         d->btControl->discoverServices();
     });
 
-    connect(d->btControl, &QLowEnergyController::disconnected, this, [this]() {
+    connect(d->btControl, &QLowEnergyController::disconnected, this, [this, controller]() {
+        if (d->btControl != controller) {
+            // We are already done with this controller (for example, it was disconnected on request)
+            return;
+        }
         qDebug() << name() << deviceID() << "LowEnergy controller disconnected";
         emit deviceMessage(deviceID(), QLatin1String("The EarGear box closed the connection, either by being turned off or losing power. Remember to charge your ears!"));
         disconnectDevice();
+        if (d->parentModel->appSettings()->autoReconnect()) {
+            scheduleReconnect();
+        }
     });
 
     // Connect
@@ -405,6 +473,9 @@ void BTDeviceEars::connectDevice()
 void BTDeviceEars::disconnectDevice()
 {
     d->pingTimer.stop();
+    d->latencyCommand.clear();
+    d->latencyFirstCall.clear();
+    CommandLatency::getInstance()->forgetPending(deviceID());
     if (d->btControl) {
         d->btControl->deleteLater();
         d->btControl = nullptr;
@@ -497,6 +568,13 @@ void BTDeviceEars::sendMessage(const QString &message)
         }
 
         d->currentSubCall = actualCall;
+        if (commandModel->commandId(message) > -1) {
+            d->latencyCommand = message;
+            d->latencyFirstCall = actualCall.toUtf8();
+        }
+        if (actualCall == QLatin1String{"PING"}) {
+            startRoundTrip();
+        }
         d->earsService->writeCharacteristic(d->earsCommandWriteCharacteristic, actualCall.toUtf8());
         d->currentCall = message;
         emit currentCallChanged(message);
@@ -102,12 +102,9 @@ void BTDeviceFake::sendMessage(const QString& message)
 {
     qDebug() << "Fakery for" << message;
     CommandInfo commandInfo;
-    const CommandInfoList& commands = commandModel->allCommands();
-    for (const CommandInfo& command : commands) {
-        if (command.command == message) {
-            commandInfo = command;
-            break;
-        }
+    const int row = commandModel->commandRow(message);
+    if (row > -1) {
+        commandInfo = commandModel->commandAt(row);
     }
     if(commandInfo.isValid()) {
         commandModel->setRunning(message, true);
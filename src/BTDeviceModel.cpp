@@ -22,6 +22,9 @@
 #include "BTDeviceFake.h"
 #include "BTDeviceEars.h"
 
+#include <QSet>
+#include <QTimer>
+
 class BTDeviceModel::Private
 {
 public:
@@ -37,11 +40,54 @@ public:
     void readDeviceNames();
 
     AppSettings* appSettings{nullptr};
-    QList<BTDevice*> devices;
+
+    // The devices in the order they were added. New devices are shown at the top of the model,
+    // so rows are counted from the end of this list, which means adding a device does not move
+    // all the others along. The IDs are kept alongside, as a device which is being destroyed is
+    // no longer able to tell us what its ID was.
+    QVector<BTDevice*> devices;
+    QVector<QString> deviceIDs;
+    QHash<QString, BTDevice*> devicesByID;
+    QHash<const BTDevice*, int> positions;
+
+    int rowOf(const BTDevice* device) const
+    {
+        const int position = positions.value(device, -1);
+        return position > -1 ? devices.count() - 1 - position : -1;
+    }
+
+    BTDevice* deviceAt(int row) const
+    {
+        if (row > -1 && row < devices.count()) {
+            return devices.at(devices.count() - 1 - row);
+        }
+        return nullptr;
+    }
+
+    void appendDevice(BTDevice* device)
+    {
+        positions[device] = devices.count();
+        devicesByID[device->deviceID()] = device;
+        devices << device;
+        deviceIDs << device->deviceID();
+    }
+
+    void removeDeviceAt(int row)
+    {
+        const int position = devices.count() - 1 - row;
+        positions.remove(devices.at(position));
+        devicesByID.remove(deviceIDs.at(position));
+        devices.remove(position);
+        deviceIDs.remove(position);
+        // Removing devices is rare enough that moving the rest along is fine
+        for (int i = position; i < devices.count(); ++i) {
+            positions[devices.at(i)] = i;
+        }
+    }
 
     void notifyDeviceDataChanged(BTDevice* device, int role)
     {
-        int pos = devices.indexOf(device);
+        int pos = rowOf(device);
         if(pos > -1) {
             QModelIndex idx(q->index(pos));
             q->dataChanged(idx, idx, QVector<int>{role});
@@ -69,11 +115,9 @@ void BTDeviceModel::Private::readDeviceNames()
 
     const QVariantMap map = appSettings->deviceNames();
     for (QVariantMap::const_iterator it = map.cbegin(); it != map.cend(); ++it) {
-        for (BTDevice* device : devices) {
-            if (device->deviceID() == it.key()) {
-                device->setName(it.value().toString());
-                break;
-            }
+        BTDevice* device = devicesByID.value(it.key());
+        if (device) {
+            device->setName(it.value().toString());
         }
     }
 }
@@ -89,13 +133,13 @@ void BTDeviceModel::setAppSettings(AppSettings *appSettings)
     connect(d->appSettings, &AppSettings::deviceNamesChanged, this, [this](){ d->readDeviceNames(); });
     d->readDeviceNames();
     connect(d->appSettings, &AppSettings::fakeTailModeChanged, this, [this](bool fakeTailMode){
-        if (fakeTailMode && !d->devices.contains(d->fakeDevice)) {
+        if (fakeTailMode && !d->positions.contains(d->fakeDevice)) {
             addDevice(d->fakeDevice);
-        } else if (!fakeTailMode && d->devices.contains(d->fakeDevice)) {
+        } else if (!fakeTailMode && d->positions.contains(d->fakeDevice)) {
             removeDevice(d->fakeDevice);
         }
     });
-    if (d->appSettings->fakeTailMode() && !d->devices.contains(d->fakeDevice)) {
+    if (d->appSettings->fakeTailMode() && !d->positions.contains(d->fakeDevice)) {
         addDevice(d->fakeDevice);
     }
 }
@@ -114,7 +158,9 @@ QHash< int, QByteArray > BTDeviceModel::roleNames() const
         {HasListening, "hasListening"},
         {ListeningState, "listeningState"},
         {EnabledCommandsFiles, "enabledCommandsFiles"},
-        {MicsSwapped, "micsSwapped"}
+        {MicsSwapped, "micsSwapped"},
+        {ReconnectState, "reconnectState"},
+        {NextReconnectAttempt, "nextReconnectAttempt"}
     };
     return roles;
 }
@@ -123,7 +169,7 @@ QVariant BTDeviceModel::data(const QModelIndex& index, int role) const
 {
     QVariant value;
     if(index.isValid() && index.row() > -1 && index.row() < d->devices.count()) {
-        BTDevice* device = d->devices.at(index.row());
+        BTDevice* device = d->deviceAt(index.row());
         switch(role) {
             case Name:
                 value = device->name();
@@ -175,6 +221,12 @@ QVariant BTDeviceModel::data(const QModelIndex& index, int role) const
                 value = micsSwapped;
                 break;
             }
+            case ReconnectState:
+                value = device->reconnectState();
+                break;
+            case NextReconnectAttempt:
+                value = device->nextReconnectAttempt();
+                break;
             default:
                 break;
         }
@@ -224,12 +276,17 @@ void BTDeviceModel::addDevice(BTDevice* newDevice)
         QLatin1String{"FAKE"}
     };
     if(acceptedDeviceNames.contains(newDevice->deviceInfo.name())) {
-        for(const BTDevice* device : d->devices) {
-            if(device->deviceID() == newDevice->deviceID()) {
-                // Don't add the same device twice. Thanks bt discovery. Thiscovery.
-                newDevice->deleteLater();
-                return;
+        BTDevice* device = d->devicesByID.value(newDevice->deviceID());
+        if(device) {
+            // Don't add the same device twice. Thanks bt discovery. Thiscovery.
+            // It does tell us the device is around, though, which is handy if we're waiting to reconnect to it,
+            // and how strong its signal is now (which is used to pick which devices to connect to first)
+            if (newDevice->deviceInfo.rssi() != 0) {
+                device->deviceInfo.setRssi(newDevice->deviceInfo.rssi());
             }
+            device->deviceSeen();
+            newDevice->deleteLater();
+            return;
         }
 
         // Device type specifics
@@ -277,19 +334,23 @@ void BTDeviceModel::addDevice(BTDevice* newDevice)
         connect(newDevice, &BTDevice::checkedChanged, this, [this, newDevice](){
             d->notifyDeviceDataChanged(newDevice, Checked);
         });
+        connect(newDevice, &BTDevice::reconnectStateChanged, this, [this, newDevice](){
+            d->notifyDeviceDataChanged(newDevice, ReconnectState);
+            d->notifyDeviceDataChanged(newDevice, NextReconnectAttempt);
+        });
         connect(newDevice, &QObject::destroyed, this, [this, newDevice](){
-            int index = d->devices.indexOf(newDevice);
+            int index = d->rowOf(newDevice);
             if(index > -1) {
                 beginRemoveRows(QModelIndex(), index, index);
                 emit deviceRemoved(newDevice);
-                d->devices.removeAll(newDevice);
+                d->removeDeviceAt(index);
                 endRemoveRows();
             }
         });
         d->readDeviceNames();
 
         beginInsertRows(QModelIndex(), 0, 0);
-        d->devices.insert(0, newDevice);
+        d->appendDevice(newDevice);
         emit deviceAdded(newDevice);
         emit countChanged();
         endInsertRows();
@@ -298,12 +359,12 @@ void BTDeviceModel::addDevice(BTDevice* newDevice)
 
 void BTDeviceModel::removeDevice(BTDevice* device)
 {
-    int idx = d->devices.indexOf(device);
+    int idx = d->rowOf(device);
     if (idx > -1) {
         beginRemoveRows(QModelIndex(), idx, idx);
         emit deviceRemoved(device);
         device->disconnect(this);
-        d->devices.removeAt(idx);
+        d->removeDeviceAt(idx);
         emit countChanged();
         endRemoveRows();
     }
@@ -319,45 +380,63 @@ int BTDeviceModel::count()
 
 BTDevice* BTDeviceModel::getDevice(const QString& deviceID) const
 {
-    for(BTDevice* device : d->devices) {
-        if(device->deviceID() == deviceID) {
-            return device;
-        }
-    }
-    return nullptr;
+    return d->devicesByID.value(deviceID);
 }
 
 BTDevice * BTDeviceModel::getDeviceById ( int index ) const
 {
-    if (index > -1 && index < d->devices.count()) {
-        return d->devices[index];
-    }
-    return nullptr;
+    return d->deviceAt(index);
 }
 
 void BTDeviceModel::updateItem(const QString& deviceID)
 {
     d->readDeviceNames();
-    for(int idx = 0; idx < d->devices.count(); ++idx) {
-        if(d->devices[idx]->deviceID() == deviceID) {
-            emit dataChanged(index(idx, 0), index(idx, 0));
-        }
+    const int idx = d->rowOf(d->devicesByID.value(deviceID));
+    if(idx > -1) {
+        emit dataChanged(index(idx, 0), index(idx, 0));
     }
 }
 
 QString BTDeviceModel::getDeviceID(int deviceIndex) const
 {
-    if(deviceIndex >= 0 && deviceIndex < d->devices.count()) {
-        return d->devices.at(deviceIndex)->deviceID();
+    const BTDevice* device = d->deviceAt(deviceIndex);
+    if(device) {
+        return device->deviceID();
     }
     return QLatin1String();
 }
 
 void BTDeviceModel::sendMessage(const QString& message, const QStringList& deviceIDs)
 {
-    for (BTDevice* device : d->devices) {
+    QList<BTDevice*> recipients;
+    int longestDelay{0};
+    if (deviceIDs.count() == 0) {
         // If there's no devices requested, send to everybody
-        if (deviceIDs.count() == 0 || deviceIDs.contains(device->deviceID())) {
+        recipients.reserve(d->devices.count());
+        for (int row = 0; row < d->devices.count(); ++row) {
+            recipients << d->deviceAt(row);
+        }
+    } else {
+        QSet<BTDevice*> requested;
+        for (const QString& deviceID : deviceIDs) {
+            BTDevice* device = d->devicesByID.value(deviceID);
+            if (device && !requested.contains(device)) {
+                requested.insert(device);
+                recipients << device;
+            }
+        }
+    }
+    for (const BTDevice* device : qAsConst(recipients)) {
+        longestDelay = qMax(longestDelay, device->oneWayDelay());
+    }
+    const bool synchronized = recipients.count() > 1 && d->appSettings && d->appSettings->synchronizedDispatch();
+    for (BTDevice* device : qAsConst(recipients)) {
+        // Hold back the devices which see our messages sooner than the slowest one,
+        // so they all start at the same time, rather than as soon as they each can
+        const int stagger = synchronized ? longestDelay - device->oneWayDelay() : 0;
+        if (synchronized && stagger > d->appSettings->synchronizedDispatchSkew()) {
+            QTimer::singleShot(stagger, Qt::PreciseTimer, device, [device, message](){ device->sendMessage(message); });
+        } else {
             device->sendMessage(message);
         }
     }
@@ -50,7 +50,9 @@ public:
         HasListening,            // 265
         ListeningState,          // 266 - either 0 (off), 1 (on in iOS mode), or 2 (full feedback mode)
         EnabledCommandsFiles,    // 267 - a stringlist
-        MicsSwapped              // 268 - boolean value for whether or not the microphones have been swapped
+        MicsSwapped,             // 268 - boolean value for whether or not the microphones have been swapped
+        ReconnectState,          // 269 - a BTDevice::ReconnectState value
+        NextReconnectAttempt     // 270 - milliseconds since epoch of the next reconnection attempt, or 0 if none is scheduled
     };
 
     AppSettings* appSettings() const;
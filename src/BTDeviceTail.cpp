@@ -17,17 +17,21 @@
 
 #include "BTDeviceTail.h"
 
-#include <QCoreApplication>
 #include <QFile>
+#include <QQueue>
 #include <QTimer>
 
 #include "AppSettings.h"
+#include "CommandLatency.h"
 #include "CommandPersistence.h"
+#include "GattLayoutCache.h"
+#include "TailNotificationParser.h"
 
-class BTDeviceTail::Private {
+class BTDeviceTail::Private : public TailNotificationParser::Handler {
 public:
     Private(BTDeviceTail* qq)
         : q(qq)
+        , parser(this)
     {}
     ~Private() {}
     BTDeviceTail* q;
@@ -43,25 +47,59 @@ public:
     QLowEnergyDescriptor tailDescriptor;
 
     QTimer batteryTimer;
+    QBluetoothUuid tailServiceUuid{QLatin1String("{0000ffe0-0000-1000-8000-00805f9b34fb}")};
     QBluetoothUuid tailStateCharacteristicUuid{QLatin1String("{0000ffe1-0000-1000-8000-00805f9b34fb}")};
 
-    int reconnectThrottle{0};
-    void reconnectDevice(QObject* context)
+    // Messages are not written to the tail until it has responded to the one already
+    // written (or we give up waiting for it to do so), so instead of waiting for that,
+    // sendMessage puts them in this queue, which is worked through as responses arrive.
+    // Only one message is ever written at a time, as the tail's notifications do not say
+    // which message they are a response to (and some of them are not responses at all),
+    // so with more than one written we could not tell which of them had been answered.
+    QQueue<QString> pendingWrites;
+    bool awaitingResponse{false};
+    QTimer writeTimeout;
+
+    void pumpWrites()
     {
-        QTimer::singleShot(0, context, [this] {
-            if (btControl) {
-                if (reconnectThrottle > 10) {
-                    q->disconnectDevice();
-                    reconnectThrottle = 0;
-                    q->deviceMessage(q->deviceID(), QString("Attempted to reconnect too many times to %1 (%2). To connect to it, please check that it is on, charged, and near enough.").arg(q->name()).arg(q->deviceID()));
-                    return;
-                }
-                qDebug() << q->name() << q->deviceID() << "Connection lost - attempting to reconnect.";
-                q->deviceMessage(q->deviceID(), QString("Connection lost to %1, attempting to reconnect...").arg(q->name()));
-                ++reconnectThrottle;
-                btControl->connectToDevice();
+        if (!awaitingResponse && !pendingWrites.isEmpty()) {
+            if (!tailCharacteristic.isValid() || !tailService) {
+                pendingWrites.clear();
+                return;
             }
-        });
+            const QString message = pendingWrites.dequeue();
+            if (message == QLatin1String("BATT")) {
+                q->startRoundTrip();
+            }
+            tailService->writeCharacteristic(tailCharacteristic, message.toUtf8());
+            awaitingResponse = true;
+            writeTimeout.start();
+            currentCall = message;
+            emit q->currentCallChanged(message);
+
+            // It is unfortunate, but we actually need to do this, as we will occasionally run into situations where we cannot trust
+            // the tail to report correctly when a command starts and ends. In short, in stead of getting the expected "END commandname"
+            // and "BEGIN commandname" notifications, we will occasionally get both of those mashed together in a single notification
+            // which further doesn't quite have everything we need (due to the character limitation on btle values), so we have to
+            // do a little internal state tracking. A shame, but here we are, and we just need to deal with that.
+            q->commandModel->setRunning(message, true);
+        }
+    }
+
+    // Called whenever the tail notifies us of something, which we take as the response
+    // to the message we wrote (if any), so the next one can be written
+    void writeResponded()
+    {
+        awaitingResponse = false;
+        writeTimeout.stop();
+        pumpWrites();
+    }
+
+    void clearWrites()
+    {
+        pendingWrites.clear();
+        awaitingResponse = false;
+        writeTimeout.stop();
     }
 
     void connectToDevice()
@@ -70,6 +108,26 @@ public:
         q->connectDevice();
     }
 
+    // Whether we knew the layout of the tail service when starting to connect. If we did, we
+    // set up the service as soon as the controller finds it, rather than waiting for it to
+    // finish discovering everything else first, skip reading the values of everything in
+    // it, and skip logging all the details again.
+    bool usingCachedLayout{false};
+
+    bool createTailService()
+    {
+        QLowEnergyService *service = btControl->createServiceObject(tailServiceUuid);
+        if (!service) {
+            return false;
+        }
+        tailService = service;
+        QObject::connect(tailService, &QLowEnergyService::stateChanged, q, [this](QLowEnergyService::ServiceState newState){ serviceStateChanged(newState); });
+        QObject::connect(tailService, &QLowEnergyService::characteristicChanged, q, [this](const QLowEnergyCharacteristic& info, const QByteArray& value){ characteristicChanged(info, value); });
+        QObject::connect(tailService, &QLowEnergyService::characteristicWritten, q, [this](const QLowEnergyCharacteristic& info, const QByteArray& value){ characteristicWritten(info, value); });
+        GattLayoutCache::discoverDetails(tailService, usingCachedLayout);
+        return true;
+    }
+
     void serviceStateChanged(QLowEnergyService::ServiceState s)
     {
         switch (s) {
@@ -80,8 +138,17 @@ public:
         {
             qDebug() << q->name() << q->deviceID() << "Service discovered.";
 
-            foreach(const QLowEnergyCharacteristic& leChar, tailService->characteristics()) {
-                qDebug() << q->name() << q->deviceID() << "Characteristic:" << leChar.name() << leChar.uuid() << leChar.properties();
+            GattLayoutCache* layoutCache = GattLayoutCache::getInstance();
+            if (usingCachedLayout && layoutCache->matches(q->deviceID(), tailService)) {
+                qDebug() << q->name() << q->deviceID() << "Service layout matches the cached one";
+            } else {
+                if (usingCachedLayout) {
+                    qDebug() << q->name() << q->deviceID() << "Service layout does not match the cached one, using the newly discovered layout";
+                    usingCachedLayout = false;
+                }
+                foreach(const QLowEnergyCharacteristic& leChar, tailService->characteristics()) {
+                    qDebug() << q->name() << q->deviceID() << "Characteristic:" << leChar.name() << leChar.uuid() << leChar.properties();
+                }
             }
             tailCharacteristic = tailService->characteristic(tailStateCharacteristicUuid);
             if (!tailCharacteristic.isValid()) {
@@ -97,7 +164,11 @@ public:
             tailDescriptor = tailCharacteristic.descriptor(QBluetoothUuid::ClientCharacteristicConfiguration);
             tailService->writeDescriptor(tailDescriptor, QByteArray::fromHex("0100"));
 
-            reconnectThrottle = 0;
+            if (!usingCachedLayout) {
+                layoutCache->store(q->deviceID(), tailService);
+            }
+            CommandLatency::getInstance()->connectionReady(q->deviceID(), usingCachedLayout);
+            q->reconnectSucceeded();
             emit q->isConnectedChanged(q->isConnected());
             q->sendMessage("VER"); // Ask for the tail version, and then react to the response...
 
@@ -109,7 +180,21 @@ public:
         }
     }
 
-    QString previousThing;
+    TailNotificationParser parser;
+    void tailEvent(TailNotificationParser::Event event, int commandId) override
+    {
+        if (event == TailNotificationParser::Begin) {
+            CommandLatency::getInstance()->commandBegan(q->deviceID(), q->commandModel->commandForId(commandId));
+        } else {
+            CommandLatency::getInstance()->commandEnded(q->deviceID(), q->commandModel->commandForId(commandId));
+        }
+        q->commandModel->setRunning(commandId, event == TailNotificationParser::Begin);
+    }
+    int tailCommandId(QLatin1String command) const override
+    {
+        return q->commandModel->commandId(command);
+    }
+
     void characteristicChanged(const QLowEnergyCharacteristic &characteristic, const QByteArray &newValue)
     {
         qDebug() << q->name() << q->deviceID() << "Current call is" << currentCall << "and characteristic" << characteristic.uuid() << "NOTIFIED value change" << newValue;
@@ -119,86 +204,35 @@ public:
                 q->reloadCommands();
                 version = newValue;
                 emit q->versionChanged(newValue);
+                GattLayoutCache::getInstance()->setFirmware(q->deviceID(), version);
                 batteryTimer.start();
                 q->sendMessage("BATT");
             }
+            // Return value for BATT calls is BAT and a number, from 0 to 4,
+            // unfortunately without a space, so we have to specialcase it a bit
+            else if(newValue.startsWith("BAT")) {
+                q->endRoundTrip();
+                batteryLevel = newValue.right(1).toInt();
+                emit q->batteryLevelChanged(batteryLevel);
+            }
             else {
-                static const QLatin1String aBegin{"BEGIN"};
-                static const QLatin1String anEnd{"END"};
-                QString theValue(newValue);
-                QStringList stateResult = theValue.split(' ');
-                // Return value for BATT calls is BAT and a number, from 0 to 4,
-                // unfortunately without a space, so we have to specialcase it a bit
-                if(theValue.startsWith(QLatin1String("BAT"))) {
-                    batteryLevel = theValue.right(1).toInt();
-                    emit q->batteryLevelChanged(batteryLevel);
-                }
-                else if(stateResult.count() == 1 && !previousThing.isEmpty()) {
-                    // See comment in the next bit to see what this is about
-                    previousThing += stateResult[0];
-                    QStringList splitThing = previousThing.split(' ');
-                    previousThing.clear();
-                    q->commandModel->setRunning(splitThing[1], (splitThing[0] == aBegin));
-                    qDebug() << "We had a remainder, and the split is now" << splitThing;
-                }
-                else if(stateResult.count() == 3 && (stateResult[0] == aBegin || stateResult[0] == anEnd)) {
-                    // This is an awkward thing that happens sometimes (and especially when a command is forced to
-                    // stop by starting another) - specifically, we will get two results happening in quick succession,
-                    // which is the expected result from two calls, just concatenated, and then split over two changes
-                    // depending on how much space the characteristic can hold (for example "END TAILS1BEGIN TAIL" and
-                    // "HM", or alternatively the other way around)
-                    QString theCommand;
-                    QString startOrEnd;
-                    if(stateResult[1].endsWith(aBegin)) {
-                        theCommand = stateResult[1].left(stateResult[1].length() - 5);
-                        startOrEnd = aBegin;
-                    }
-                    else if(stateResult[1].endsWith(anEnd)) {
-                        theCommand = stateResult[1].left(stateResult[1].length() - 3);
-                        startOrEnd = anEnd;
-                    }
-                    q->commandModel->setRunning(theCommand, (stateResult[0] == aBegin));
-                    // Now let's just see whether that second thing is actually a full command or not (at which point
-                    // we should be expecting another notification shortly)
-                    bool fullCommand{false};
-                    for(const CommandInfo& cmd : qAsConst(q->commandModel->allCommands())) {
-                        if (cmd.command == stateResult[2]) {
-                            fullCommand = true;
-                            break;
-                        }
-                    }
-                    if (fullCommand) {
-                        q->commandModel->setRunning(stateResult[2], (startOrEnd == aBegin));
-                        qDebug() << "Detected a complete squashed command, with the command" << theCommand << ", the type" << stateResult[0] << ", the startOrEnd" << startOrEnd << ", and the end command" << stateResult[2];
-                    } else {
-                        previousThing = QString("%1 %2").arg(startOrEnd).arg(stateResult[2]);
-                        qDebug() << "Detected an incomplete squashed command, with the command" << theCommand << ", the type" << stateResult[0] << ", and the remainder" << previousThing;
-                    }
-                }
-                else if(stateResult.count() == 2) {
-                    if(stateResult[0] == aBegin) {
-                        q->commandModel->setRunning(stateResult[1], true);
-                    }
-                    else if(stateResult[0] == anEnd) {
-                        q->commandModel->setRunning(stateResult[1], false);
-                    }
-                    else {
-                        qDebug() << q->name() << q->deviceID() << "Unexpected response: The first element of the two part message should be either BEGIN or END";
-                    }
-                }
-                else {
-                    qDebug() << q->name() << q->deviceID() << "Unexpected response: The response should consist of a string of two words separated by a single space, the first word being either BEGIN or END, and the second should be the command name either just beginning its run, or having just ended its run.";
-                }
+                // Everything else is BEGIN and END notifications, which may arrive squashed together
+                // and split across several notifications, so we leave the untangling to the parser
+                parser.feed(newValue);
             }
         }
         currentCall.clear();
         emit q->currentCallChanged(currentCall);
+        writeResponded();
     }
 
     void characteristicWritten(const QLowEnergyCharacteristic &characteristic, const QByteArray &newValue)
     {
         qDebug() << q->name() << q->deviceID() << "Characteristic written:" << characteristic.uuid() << newValue;
         currentCall = newValue;
+        if (q->commandModel->commandId(currentCall) > -1) {
+            CommandLatency::getInstance()->commandWritten(q->deviceID(), currentCall);
+        }
         emit q->currentCallChanged(currentCall);
     }
 };
@@ -218,6 +252,17 @@ BTDeviceTail::BTDeviceTail(const QBluetoothDeviceInfo& info, BTDeviceModel* pare
     d->batteryTimer.setTimerType(Qt::VeryCoarseTimer);
     d->batteryTimer.setInterval(60000 / 2);
     d->batteryTimer.setSingleShot(false);
+
+    // If the tail doesn't get back to us, we don't want to hold up everything else forever
+    d->writeTimeout.setInterval(1000);
+    d->writeTimeout.setSingleShot(true);
+    connect(&d->writeTimeout, &QTimer::timeout, this, [this](){
+        qDebug() << name() << deviceID() << "Gave up waiting for a response to" << d->currentCall;
+        d->awaitingResponse = false;
+        d->currentCall.clear();
+        emit currentCallChanged(d->currentCall);
+        d->pumpWrites();
+    });
 }
 
 BTDeviceTail::~BTDeviceTail()
@@ -233,34 +278,33 @@ void BTDeviceTail::connectDevice()
 
     d->btControl = QLowEnergyController::createCentral(deviceInfo, this);
     d->btControl->setRemoteAddressType(QLowEnergyController::RandomAddress);
+    QLowEnergyController* controller = d->btControl;
 
     if(d->tailService) {
         d->tailService->deleteLater();
         d->tailService = nullptr;
     }
 
+    CommandLatency::getInstance()->connectionStarted(deviceID());
+    d->usingCachedLayout = GattLayoutCache::getInstance()->hasLayout(deviceID(), d->tailServiceUuid);
+
     connect(d->btControl, &QLowEnergyController::serviceDiscovered,
         [this](const QBluetoothUuid &gatt){
             qDebug() << name() << deviceID() << "service discovered" << gatt;
+            if (d->usingCachedLayout && gatt == d->tailServiceUuid && !d->tailService) {
+                // If this doesn't work out yet, we will try again once discovery is finished
+                d->createTailService();
+            }
         });
 
     connect(d->btControl, &QLowEnergyController::discoveryFinished,
             [this](){
                 qDebug() << name() << deviceID()<< "Done!";
-                QLowEnergyService *service = d->btControl->createServiceObject(QBluetoothUuid(QLatin1String("{0000ffe0-0000-1000-8000-00805f9b34fb}")));
-
-                if (!service) {
-                    qWarning() << "Cannot create QLowEnergyService for {0000ffe0-0000-1000-8000-00805f9b34fb}";
+                if (!d->tailService && !d->createTailService()) {
+                    qWarning() << "Cannot create QLowEnergyService for" << d->tailServiceUuid;
                     emit deviceMessage(deviceID(), QLatin1String("An error occured while connecting to your tail (the service object could not be created). If you feel this is in error, please try again!"));
                     disconnectDevice();
-                    return;
                 }
-
-                d->tailService = service;
-                connect(d->tailService, &QLowEnergyService::stateChanged, this, [this](QLowEnergyService::ServiceState newState){ d->serviceStateChanged(newState); });
-                connect(d->tailService, &QLowEnergyService::characteristicChanged, this, [this](const QLowEnergyCharacteristic& info, const QByteArray& value){ d->characteristicChanged(info, value); });
-                connect(d->tailService, &QLowEnergyService::characteristicWritten, this, [this](const QLowEnergyCharacteristic& info, const QByteArray& value){ d->characteristicWritten(info, value); });
-                d->tailService->discoverDetails();
             });
 
     connect(d->btControl, static_cast<void (QLowEnergyController::*)(QLowEnergyController::Error)>(&QLowEnergyController::error),
@@ -281,10 +325,9 @@ void BTDeviceTail::connectDevice()
                     break;
             }
 
+            disconnectDevice();
             if (d->parentModel->appSettings()->autoReconnect()) {
-                d->reconnectDevice(this);
-            } else {
-                disconnectDevice();
+                scheduleReconnect();
             }
         });
 
@@ -293,10 +336,17 @@ void BTDeviceTail::connectDevice()
         d->btControl->discoverServices();
     });
 
-    connect(d->btControl, &QLowEnergyController::disconnected, this, [this]() {
+    connect(d->btControl, &QLowEnergyController::disconnected, this, [this, controller]() {
+        if (d->btControl != controller) {
+            // We are already done with this controller (for example, it was disconnected on request)
+            return;
+        }
         qDebug() << name() << deviceID() << "LowEnergy controller disconnected";
         emit deviceMessage(deviceID(), QLatin1String("The tail closed the connection, either by being turned off or losing power. Remember to charge your tail!"));
         disconnectDevice();
+        if (d->parentModel->appSettings()->autoReconnect()) {
+            scheduleReconnect();
+        }
     });
 
     // Connect
@@ -306,10 +356,17 @@ void BTDeviceTail::connectDevice()
 void BTDeviceTail::disconnectDevice()
 {
     d->batteryTimer.stop();
-    d->btControl->deleteLater();
-    d->btControl = nullptr;
-    d->tailService->deleteLater();
-    d->tailService = nullptr;
+    d->clearWrites();
+    d->parser.reset();
+    CommandLatency::getInstance()->forgetPending(deviceID());
+    if (d->btControl) {
+        d->btControl->deleteLater();
+        d->btControl = nullptr;
+    }
+    if (d->tailService) {
+        d->tailService->deleteLater();
+        d->tailService = nullptr;
+    }
     commandModel->clear();
     commandShorthands.clear();
 //     emit commandModelChanged();
@@ -347,24 +404,20 @@ QString BTDeviceTail::deviceID() const
 
 void BTDeviceTail::sendMessage(const QString &message)
 {
-    // Don't send out another call while we're waiting to hear back... at least for a little bit
-    int i = 0;
-    while(!d->currentCall.isEmpty()) {
-        if(++i == 1000) {
-            break;
-        }
-        qApp->processEvents();
-    }
+    // Don't send out another call while we're waiting to hear back, but also don't wait
+    // around for it here, just queue it up and it will be sent once the tail responds
     if (d->tailCharacteristic.isValid() && d->tailService) {
-        d->tailService->writeCharacteristic(d->tailCharacteristic, message.toUtf8());
-        d->currentCall = message;
-        emit currentCallChanged(message);
-
-        // It is unfortunate, but we actually need to do this, as we will occasionally run into situations where we cannot trust
-        // the tail to report correctly when a command starts and ends. In short, in stead of getting the expected "END commandname"
-        // and "BEGIN commandname" notifications, we will occasionally get both of those mashed together in a single notification
-        // which further doesn't quite have everything we need (due to the character limitation on btle values), so we have to
-        // do a little internal state tracking. A shame, but here we are, and we just need to deal with that.
-        commandModel->setRunning(message, true);
+        d->pendingWrites.enqueue(message);
+        d->pumpWrites();
     }
 }
+
+int BTDeviceTail::writeTimeout() const
+{
+    return d->writeTimeout.interval();
+}
+
+void BTDeviceTail::setWriteTimeout(int writeTimeout)
+{
+    d->writeTimeout.setInterval(writeTimeout);
+}
@@ -37,7 +37,21 @@ public:
 
     QString deviceID() const override;
 
+    /**
+     * Send a message to the tail. This never blocks: the message is queued, and
+     * written once the tail has responded to the message written before it (or
+     * writeTimeout() has passed). Messages are always written in the order they were sent.
+     * @param message The message to send to the tail
+     */
     void sendMessage(const QString &message) override;
+
+    /**
+     * How long (in milliseconds) to wait for the tail to respond to a message,
+     * before giving up on it and moving on to the next queued message.
+     * The default is 1000 milliseconds.
+     */
+    int writeTimeout() const;
+    void setWriteTimeout(int writeTimeout);
 private:
     class Private;
     Private* d;
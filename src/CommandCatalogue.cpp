@@ -0,0 +1,74 @@
+/*
+ *   Copyright 2021 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#include "CommandCatalogue.h"
+
+#include "AppSettings.h"
+#include "CommandPersistence.h"
+
+#include <QHash>
+
+class CommandCatalogue::Private
+{
+public:
+    Private() {}
+    // Keyed on filename, holding the hash of the contents the file was loaded from
+    QHash<QString, QPair<QByteArray, File>> files;
+};
+
+CommandCatalogue::CommandCatalogue()
+    : d(new Private)
+{
+}
+
+CommandCatalogue::~CommandCatalogue()
+{
+    delete d;
+}
+
+CommandCatalogue::File CommandCatalogue::file(const QString& filename, AppSettings* appSettings)
+{
+    const QByteArray hash = appSettings->commandFileHash(filename);
+    if (!hash.isEmpty()) {
+        QHash<QString, QPair<QByteArray, File>>::const_iterator it = d->files.constFind(filename);
+        if (it != d->files.constEnd() && it.value().first == hash) {
+            return it.value().second;
+        }
+    }
+
+    File file;
+    CommandPersistence persistence;
+    // Use the compiled version of the file if there is one, and only parse the json if we have to
+    if (!persistence.deserializeCompiled(appSettings->compiledCommandFile(filename), hash)) {
+        QVariantMap fileMap = appSettings->commandFiles()[filename].toMap();
+        persistence.deserialize(fileMap[QLatin1String{"contents"}].toString());
+    }
+    file.error = persistence.error();
+    if (file.error.isEmpty()) {
+        file.commands = persistence.commands();
+        for (const CommandShorthand& shorthand : persistence.shorthands()) {
+            file.shorthands[shorthand.command] = shorthand.expansion.join(QChar{';'});
+        }
+        // Only keep the files we know the contents of, anything else will simply be loaded again next time
+        if (!hash.isEmpty()) {
+            d->files[filename] = qMakePair(hash, file);
+        }
+    } else {
+        d->files.remove(filename);
+    }
+    return file;
+}
@@ -0,0 +1,79 @@
+/*
+ *   Copyright 2021 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#ifndef COMMANDCATALOGUE_H
+#define COMMANDCATALOGUE_H
+
+#include <QMap>
+#include <QString>
+
+#include "CommandInfo.h"
+
+class AppSettings;
+
+/**
+ * A process-wide catalogue of the parsed contents of the crumpet files.
+ *
+ * The commands and shorthands in a crumpet file are the same for every device
+ * which has that file enabled, so rather than each device parsing the file into
+ * its own copy, they all share the implicitly shared lists held here. Nothing
+ * should change those lists (the devices keep their running and available state
+ * separately, see TailCommandModel), so they are never actually copied.
+ *
+ * Files are kept by their filename and the hash of their contents, so changing
+ * the contents of a file results in it being parsed again on the next request.
+ */
+class CommandCatalogue
+{
+public:
+    ~CommandCatalogue();
+
+    static CommandCatalogue* getInstance() {
+        static CommandCatalogue* instance = nullptr;
+        if(!instance) {
+            instance = new CommandCatalogue();
+        }
+        return instance;
+    }
+
+    class File {
+    public:
+        CommandInfoList commands;
+        /// The shorthands of the file, with each expansion joined into a single semicolon separated string
+        QMap<QString, QString> shorthands;
+        /// If the file could not be loaded, this describes why (and commands and shorthands will be empty)
+        QString error;
+    };
+
+    /**
+     * Get the parsed contents of the named command file, as currently held by
+     * the application settings. If the file has not been requested before, or
+     * its contents have changed since, it will be loaded (from the compiled form
+     * if available, see AppSettings::compiledCommandFile()).
+     *
+     * @param filename The name of the command file
+     * @param appSettings The settings instance holding the command files
+     * @return The shared contents of the file
+     */
+    File file(const QString& filename, AppSettings* appSettings);
+private:
+    explicit CommandCatalogue();
+    class Private;
+    Private* d;
+};
+
+#endif//COMMANDCATALOGUE_H
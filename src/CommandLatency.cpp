@@ -0,0 +1,293 @@
+/*
+ *   Copyright 2021 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#include "CommandLatency.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QTimer>
+#include <QVector>
+#include <QtMath>
+
+#include <cstring>
+
+namespace {
+    // A log-linear histogram, in the style of HdrHistogram: values below 16 each get
+    // their own bucket, and every power of two above that is split into 16 buckets,
+    // so any value is represented to within 1/16th (about 6%) of itself.
+    class Histogram {
+    public:
+        Histogram() { memset(counts, 0, sizeof(counts)); }
+
+        static const int subBucketBits{4};
+        static const int subBucketCount{1 << subBucketBits};
+        // Enough for values of up to 2^39 microseconds (a little over six days)
+        static const int magnitudes{36};
+        static const int bucketCount{(magnitudes + 1) * subBucketCount};
+
+        void record(qint64 value)
+        {
+            ++counts[bucketOf(qMax<qint64>(0, value))];
+            ++total;
+        }
+
+        // The value at the given percentile (from 0 to 100), or 0 if there are no samples
+        qint64 percentile(double percentile) const
+        {
+            if (total == 0) {
+                return 0;
+            }
+            const quint64 target = qMax<quint64>(1, quint64(qCeil(percentile / 100.0 * total)));
+            quint64 seen{0};
+            for (int bucket = 0; bucket < bucketCount; ++bucket) {
+                seen += counts[bucket];
+                if (seen >= target) {
+                    return valueOf(bucket);
+                }
+            }
+            return valueOf(bucketCount - 1);
+        }
+
+        quint64 total{0};
+    private:
+        static int bucketOf(qint64 value)
+        {
+            if (value < subBucketCount) {
+                return int(value);
+            }
+            const int magnitude = 63 - qCountLeadingZeroBits(quint64(value));
+            const int shift = magnitude - subBucketBits;
+            if (shift + 1 > magnitudes) {
+                return bucketCount - 1;
+            }
+            return (shift + 1) * subBucketCount + int((value >> shift) - subBucketCount);
+        }
+
+        // The middle of the range of values held by the bucket
+        static qint64 valueOf(int bucket)
+        {
+            if (bucket < subBucketCount) {
+                return bucket;
+            }
+            const int shift = bucket / subBucketCount - 1;
+            const qint64 lowest = qint64(subBucketCount + bucket % subBucketCount) << shift;
+            return lowest + ((qint64(1) << shift) >> 1);
+        }
+
+        quint32 counts[bucketCount];
+    };
+}
+
+class CommandLatency::Private
+{
+public:
+    Private(CommandLatency* qq)
+        : q(qq)
+    {
+        clock.start();
+        publishTimer.setSingleShot(true);
+        publishTimer.setInterval(1000);
+        QObject::connect(&publishTimer, &QTimer::timeout, q, [this](){ emit q->latenciesChanged(q->latencies()); });
+    }
+    CommandLatency* q;
+
+    enum Stage {
+        EnqueueToWrite,
+        WriteToBegin,
+        BeginToEnd,
+        EnqueueToEnd,
+        ConnectToReady,
+        CachedConnectToReady,
+        StageCount
+    };
+
+    // The times (in microseconds on our clock) a command reached each stage, or -1 if it hasn't
+    struct Trace {
+        qint64 enqueued{-1};
+        qint64 written{-1};
+        qint64 began{-1};
+    };
+
+    struct Device {
+        Histogram histograms[StageCount];
+        // When each command was queued for this device, oldest first, for commands not yet written
+        QHash<QString, QVector<qint64>> queued;
+        // The commands which have been written, but not yet ended
+        QHash<QString, Trace> traces;
+        // When we started connecting to the device, or -1 if we are not currently connecting
+        qint64 connectStarted{-1};
+    };
+    QHash<QString, Device> devices;
+
+    QElapsedTimer clock;
+    QTimer publishTimer;
+
+    qint64 now() const
+    {
+        return clock.nsecsElapsed() / 1000;
+    }
+
+    void record(Device& device, Stage stage, qint64 from, qint64 to)
+    {
+        if (from > -1) {
+            device.histograms[stage].record(to - from);
+            if (!publishTimer.isActive()) {
+                publishTimer.start();
+            }
+        }
+    }
+};
+
+CommandLatency::CommandLatency(QObject* parent)
+    : CommandLatencyProxySource(parent)
+    , d(new Private(this))
+{
+}
+
+CommandLatency::~CommandLatency()
+{
+    delete d;
+}
+
+QVariantMap CommandLatency::latencies() const
+{
+    static const char* stageNames[Private::StageCount] = {"enqueueToWrite", "writeToBegin", "beginToEnd", "enqueueToEnd", "connectToReady", "cachedConnectToReady"};
+    QVariantMap latencies;
+    for (QHash<QString, Private::Device>::const_iterator device = d->devices.constBegin(); device != d->devices.constEnd(); ++device) {
+        QVariantMap stages;
+        for (int stage = 0; stage < Private::StageCount; ++stage) {
+            const Histogram& histogram = device.value().histograms[stage];
+            stages[QLatin1String(stageNames[stage])] = QVariantMap{
+                {QLatin1String("count"), histogram.total},
+                {QLatin1String("p50"), histogram.percentile(50) / 1000.0},
+                {QLatin1String("p95"), histogram.percentile(95) / 1000.0},
+                {QLatin1String("p99"), histogram.percentile(99) / 1000.0}
+            };
+        }
+        latencies[device.key()] = stages;
+    }
+    return latencies;
+}
+
+void CommandLatency::reset()
+{
+    for (Private::Device& device : d->devices) {
+        for (int stage = 0; stage < Private::StageCount; ++stage) {
+            device.histograms[stage] = Histogram();
+        }
+    }
+    emit latenciesChanged(latencies());
+}
+
+void CommandLatency::commandQueued(const QString& command, const QStringList& deviceIDs)
+{
+    const qint64 now = d->now();
+    for (const QString& deviceID : deviceIDs) {
+        QVector<qint64>& queued = d->devices[deviceID].queued[command];
+        // Anything which has been waiting for this long has likely been lost along the way
+        if (queued.count() > 32) {
+            queued.removeFirst();
+        }
+        queued << now;
+    }
+}
+
+void CommandLatency::commandDropped(const QString& command, const QStringList& deviceIDs)
+{
+    for (QHash<QString, Private::Device>::iterator device = d->devices.begin(); device != d->devices.end(); ++device) {
+        if (!deviceIDs.isEmpty() && !deviceIDs.contains(device.key())) {
+            continue;
+        }
+        QHash<QString, QVector<qint64>>::iterator queued = device.value().queued.find(command);
+        if (queued != device.value().queued.end()) {
+            // The most recently queued one is the one being dropped
+            queued.value().removeLast();
+            if (queued.value().isEmpty()) {
+                device.value().queued.erase(queued);
+            }
+        }
+    }
+}
+
+void CommandLatency::commandWritten(const QString& deviceID, const QString& command)
+{
+    Private::Device& device = d->devices[deviceID];
+    Private::Trace trace;
+    trace.written = d->now();
+    QHash<QString, QVector<qint64>>::iterator queued = device.queued.find(command);
+    if (queued != device.queued.end()) {
+        trace.enqueued = queued.value().takeFirst();
+        if (queued.value().isEmpty()) {
+            device.queued.erase(queued);
+        }
+    }
+    d->record(device, Private::EnqueueToWrite, trace.enqueued, trace.written);
+    device.traces[command] = trace;
+}
+
+void CommandLatency::commandBegan(const QString& deviceID, const QString& command)
+{
+    Private::Device& device = d->devices[deviceID];
+    QHash<QString, Private::Trace>::iterator trace = device.traces.find(command);
+    if (trace != device.traces.end() && trace.value().began == -1) {
+        trace.value().began = d->now();
+        d->record(device, Private::WriteToBegin, trace.value().written, trace.value().began);
+    }
+}
+
+void CommandLatency::commandEnded(const QString& deviceID, const QString& command)
+{
+    Private::Device& device = d->devices[deviceID];
+    QHash<QString, Private::Trace>::iterator trace = device.traces.find(command);
+    if (trace != device.traces.end()) {
+        const qint64 now = d->now();
+        d->record(device, Private::BeginToEnd, trace.value().began, now);
+        d->record(device, Private::EnqueueToEnd, trace.value().enqueued, now);
+        device.traces.erase(trace);
+    }
+}
+
+void CommandLatency::forgetPending(const QString& deviceID)
+{
+    if (deviceID.isEmpty()) {
+        for (Private::Device& device : d->devices) {
+            device.queued.clear();
+        }
+    } else {
+        QHash<QString, Private::Device>::iterator device = d->devices.find(deviceID);
+        if (device != d->devices.end()) {
+            device.value().queued.clear();
+        }
+    }
+}
+
+void CommandLatency::connectionStarted(const QString& deviceID)
+{
+    d->devices[deviceID].connectStarted = d->now();
+}
+
+void CommandLatency::connectionReady(const QString& deviceID, bool usedCachedLayout)
+{
+    Private::Device& device = d->devices[deviceID];
+    if (device.connectStarted > -1) {
+        const qint64 now = d->now();
+        qDebug() << deviceID << "Ready" << (now - device.connectStarted) / 1000 << "ms after starting to connect" << (usedCachedLayout ? "(using the cached service layout)" : "(with full service discovery)");
+        d->record(device, usedCachedLayout ? Private::CachedConnectToReady : Private::ConnectToReady, device.connectStarted, now);
+        device.connectStarted = -1;
+    }
+}
@@ -0,0 +1,125 @@
+/*
+ *   Copyright 2021 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#ifndef COMMANDLATENCY_H
+#define COMMANDLATENCY_H
+
+#include "rep_CommandLatencyProxy_source.h"
+
+/**
+ * Keeps track of how long commands take to get through each stage on their way
+ * to the devices, so we can tell whether time is being lost on our side, in the
+ * bluetooth stack, or in the device's firmware. The stages are:
+ *
+ * - enqueueToWrite: From the command being added to the CommandQueue, until the
+ *   write of the command to the device has been confirmed
+ * - writeToBegin: From the write being confirmed, until the device reports that
+ *   the command has begun
+ * - beginToEnd: From the device reporting that the command has begun, until it
+ *   reports the command having ended
+ * - enqueueToEnd: The whole trip, from the queue to the end of the command
+ *
+ * Alongside those, we also keep track of how long it takes from starting to connect
+ * to a device, until it is ready for use, in connectToReady when the services had
+ * to be discovered in full, and cachedConnectToReady when we already knew the layout
+ * of the services from an earlier connection (see GattLayoutCache).
+ *
+ * All times are taken from a monotonic clock, and kept in a log-linear histogram
+ * per device and stage, so the percentiles are accurate to within about 6%.
+ */
+class CommandLatency : public CommandLatencyProxySource
+{
+    Q_OBJECT
+public:
+    ~CommandLatency() override;
+
+    static CommandLatency* getInstance() {
+        static CommandLatency* instance = nullptr;
+        if(!instance) {
+            instance = new CommandLatency();
+        }
+        return instance;
+    }
+
+    /**
+     * The latency statistics for each device, keyed on device ID. Each device has an
+     * entry for each stage (see the class description), which in turn holds "count"
+     * (the number of samples), and "p50", "p95", and "p99", in milliseconds.
+     * The property is updated at most once per second.
+     */
+    QVariantMap latencies() const override;
+    /**
+     * Forget all the samples gathered so far
+     */
+    Q_SLOT void reset() override;
+
+    /**
+     * Call when a command has been added to the command queue
+     * @param command The actual command
+     * @param deviceIDs The devices the command will be sent to
+     */
+    void commandQueued(const QString& command, const QStringList& deviceIDs);
+    /**
+     * Call when a command which was added to the command queue is removed from it again
+     * without being sent, so it is not mistaken for a later copy of the same command
+     * @param command The actual command
+     * @param deviceIDs The devices the command would have been sent to (or an empty list for all devices)
+     */
+    void commandDropped(const QString& command, const QStringList& deviceIDs);
+    /**
+     * Call when the write of a command to a device has been confirmed
+     * @param deviceID The device the command was written to
+     * @param command The actual command
+     */
+    void commandWritten(const QString& deviceID, const QString& command);
+    /**
+     * Call when a device reports that a command has begun
+     * @param deviceID The device which reported the command beginning
+     * @param command The actual command
+     */
+    void commandBegan(const QString& deviceID, const QString& command);
+    /**
+     * Call when a device reports that a command has ended
+     * @param deviceID The device which reported the command ending
+     * @param command The actual command
+     */
+    void commandEnded(const QString& deviceID, const QString& command);
+    /**
+     * Forget any commands which have been queued, but not yet written to the device
+     * (for example when the device disconnects, or its commands are removed from the queue)
+     * @param deviceID The device to forget the commands for (or an empty string for all devices)
+     */
+    void forgetPending(const QString& deviceID);
+
+    /**
+     * Call when starting to connect to a device
+     * @param deviceID The device being connected to
+     */
+    void connectionStarted(const QString& deviceID);
+    /**
+     * Call when a device is connected and ready for use
+     * @param deviceID The device which is now ready
+     * @param usedCachedLayout Whether the layout of the device's services was already known
+     */
+    void connectionReady(const QString& deviceID, bool usedCachedLayout);
+private:
+    explicit CommandLatency(QObject* parent = nullptr);
+    class Private;
+    Private* d;
+};
+
+#endif//COMMANDLATENCY_H
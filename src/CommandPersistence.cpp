@@ -19,6 +19,8 @@
 
 #include <QDebug>
 
+#include <QCryptographicHash>
+#include <QDataStream>
 #include <QDir>
 #include <QStandardPaths>
 
@@ -26,6 +28,11 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 
+// Compiled crumpets start with this marker ("CRMP") followed by the format version,
+// which should be bumped whenever the layout written by compiled() changes
+static const quint32 compiledCrumpetMagic{0x43524d50};
+static const quint32 compiledCrumpetVersion{1};
+
 class CommandPersistence::Private {
 public:
     Private(CommandPersistence* q)
@@ -123,6 +130,82 @@ bool CommandPersistence::deserialize(const QString& json)
     return keepgoing;
 }
 
+bool CommandPersistence::deserializeCompiled(const QByteArray& compiled, const QByteArray& contentHash)
+{
+    QDataStream stream(compiled);
+    stream.setVersion(QDataStream::Qt_5_12);
+    quint32 magic{0};
+    quint32 version{0};
+    QByteArray compiledHash;
+    stream >> magic >> version;
+    if (magic != compiledCrumpetMagic || version != compiledCrumpetVersion) {
+        return false;
+    }
+    stream >> compiledHash;
+    if (!contentHash.isEmpty() && compiledHash != contentHash) {
+        return false;
+    }
+
+    QString title;
+    QString description;
+    quint32 commandCount{0};
+    stream >> title >> description >> commandCount;
+    CommandInfoList commandsList;
+    commandsList.reserve(int(commandCount));
+    for (quint32 i = 0; i < commandCount && stream.status() == QDataStream::Ok; ++i) {
+        CommandInfo info;
+        qint32 duration{0};
+        qint32 minimumCooldown{0};
+        qint32 group{0};
+        stream >> info.name >> info.command >> info.category >> duration >> minimumCooldown >> group;
+        info.duration = duration;
+        info.minimumCooldown = minimumCooldown;
+        info.group = group;
+        commandsList.append(info);
+    }
+    quint32 shorthandCount{0};
+    stream >> shorthandCount;
+    CommandShorthandList shorthandList;
+    for (quint32 i = 0; i < shorthandCount && stream.status() == QDataStream::Ok; ++i) {
+        CommandShorthand shorthand;
+        stream >> shorthand.command >> shorthand.expansion;
+        shorthandList.append(shorthand);
+    }
+    if (stream.status() != QDataStream::Ok) {
+        qDebug() << "The compiled crumpet was truncated or otherwise damaged, ignoring it";
+        return false;
+    }
+
+    d->error.clear();
+    setTitle(title);
+    setDescription(description);
+    setShorthands(shorthandList);
+    setCommands(commandsList);
+    return true;
+}
+
+QByteArray CommandPersistence::compiled(const QByteArray& contentHash) const
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_12);
+    stream << compiledCrumpetMagic << compiledCrumpetVersion << contentHash;
+    stream << d->title << d->description << quint32(d->commands.count());
+    for (const CommandInfo& command : d->commands) {
+        stream << command.name << command.command << command.category << qint32(command.duration) << qint32(command.minimumCooldown) << qint32(command.group);
+    }
+    stream << quint32(d->shorthands.count());
+    for (const CommandShorthand& shorthand : d->shorthands) {
+        stream << shorthand.command << shorthand.expansion;
+    }
+    return data;
+}
+
+QByteArray CommandPersistence::contentHash(const QString& json)
+{
+    return QCryptographicHash::hash(json.toUtf8(), QCryptographicHash::Sha1);
+}
+
 QString CommandPersistence::serialized() const
 {
     QJsonArray commands;
@@ -90,6 +90,38 @@ public:
      * @see read()
      */
     bool deserialize(const QString& json);
+    /**
+     * Set the title, description, commands and shorthands from a compiled
+     * version of a crumpet file, as produced by compiled(). This is much cheaper
+     * than parsing the json, and is what devices use when (re)loading commands.
+     *
+     * If the data is not a compiled crumpet, was compiled by a different version
+     * of the format, or (if one is given) was compiled from contents with a
+     * different hash, nothing is changed and false is returned, and you should
+     * fall back to deserialize(QString) on the original json.
+     *
+     * @param compiled The compiled data, as produced by compiled()
+     * @param contentHash The hash of the json the data is expected to be compiled from (optional)
+     * @return Whether or not the compiled data was successfully loaded
+     * @see contentHash(QString)
+     */
+    bool deserializeCompiled(const QByteArray& compiled, const QByteArray& contentHash = QByteArray());
+    /**
+     * Get a compiled, versioned binary version of what is currently stored in
+     * this class, which can be loaded using deserializeCompiled().
+     *
+     * @param contentHash The hash of the json this was deserialized from, which is stored alongside the data
+     * @return The compiled data
+     */
+    QByteArray compiled(const QByteArray& contentHash) const;
+    /**
+     * A hash of the given json, used to find out whether some compiled data
+     * is still what you would get from deserialising that json
+     *
+     * @param json The json contents of a crumpet file
+     * @return A hash of the contents
+     */
+    static QByteArray contentHash(const QString& json);
     /**
      * Get the json serialised version of what is currently stored in this class.
      * This is also what will be stored in the file when you write it.
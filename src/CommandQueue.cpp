@@ -20,7 +20,10 @@
 #include "BTDeviceCommandModel.h"
 #include "BTDeviceModel.h"
 #include "BTDevice.h"
+#include "CommandLatency.h"
 
+#include <QDateTime>
+#include <QElapsedTimer>
 #include <QTimer>
 
 class CommandQueue::Private
@@ -30,14 +33,11 @@ public:
         : q(qq)
         , connectionManager(connectionManager)
     {
-        currentCommandTimer = new QTimer(qq);
-        currentCommandTimer->setSingleShot(true);
-        currentCommandTimerChecker = new QTimer(qq);
-        currentCommandTimerChecker->setInterval(100);
-        q->connect(currentCommandTimer, &QTimer::timeout, [this](){
-            currentCommandTimerChecker->stop();
-            emit q->currentCommandRemainingMSecondsChanged(0);
-        });
+        epoch.start();
+        popTimer = new QTimer(qq);
+        popTimer->setSingleShot(true);
+        popTimer->setTimerType(Qt::PreciseTimer);
+        q->connect(popTimer, &QTimer::timeout, q, [this](){ pop(); });
     }
     ~Private() {}
 
@@ -50,35 +50,263 @@ public:
         ~Entry() { }
         CommandInfo command;
         QStringList deviceIDs;
+        qint64 deadline{0}; // milliseconds since the queue's epoch
+        qint64 enqueued{0}; // milliseconds since the queue's epoch
+        int priority{MoveListPriority};
     };
     QVector<Entry*> commands;
     BTConnectionManager* connectionManager;
 
+    // All scheduling is done against absolute deadlines, measured in milliseconds
+    // since this epoch, so that the time spent getting around to firing one entry
+    // does not get added on to every entry after it.
+    QElapsedTimer epoch;
     QTimer* popTimer;
-    QTimer* currentCommandTimer;
-    QTimer* currentCommandTimerChecker;
 
-    void pop()
+    // Wall clock times (in milliseconds since the unix epoch), as these are passed on
+    // to the replicas, which do not share our QElapsedTimer epoch
+    qint64 currentCommandStartTimestamp{0};
+    qint64 currentCommandEndTimestamp{0};
+
+    // Each device gets its own lane, which drains its own entries independently of
+    // the other devices. The lane with the empty ID is used by entries which are
+    // sent to all devices, and acts as a barrier for every other lane.
+    // laneBusyUntil holds the time at which the entries already launched in each lane
+    // are done, and laneTails the time at which the last planned entry will be done.
+    QHash<QString, qint64> laneBusyUntil;
+    QHash<QString, qint64> laneTails;
+
+    // Pauses which have been launched are kept apart from the commands, as a pause only
+    // holds up entries of its own or a lower priority. Anything more important goes
+    // straight past it (so a long casual mode pause does not hold up a gesture).
+    struct Pause {
+        qint64 until{0};
+        int priority{PriorityCount};
+    };
+    QHash<QString, Pause> lanePauses;
+
+    int lastLateness{0};
+    int maximumLateness{0};
+    qint64 totalLateness{0};
+    qint64 latenessSamples{0};
+
+    struct WaitTimes {
+        qint64 total{0};
+        qint64 samples{0};
+        int maximum{0};
+    };
+    WaitTimes waitTimes[PriorityCount];
+
+    qint64 entryDuration(const Entry* entry) const
+    {
+        return entry->command.duration + entry->command.minimumCooldown;
+    }
+
+    // The time until which the pause running in the lane holds up entries of the given priority
+    qint64 pausedUntil(const QString& lane, int priority) const
+    {
+        QHash<QString, Pause>::const_iterator pause = lanePauses.constFind(lane);
+        if (pause != lanePauses.constEnd() && pause.value().priority <= priority) {
+            return pause.value().until;
+        }
+        return 0;
+    }
+
+    // The latest time until which any pause holds up entries of the given priority
+    qint64 latestPause(int priority) const
+    {
+        qint64 latest{0};
+        for (const Pause& pause : lanePauses) {
+            if (pause.priority <= priority) {
+                latest = qMax(latest, pause.until);
+            }
+        }
+        return latest;
+    }
+
+    // Work out the deadline for an entry added after all the currently planned
+    // ones, and move the tails of its lanes along to the end of it
+    void planEntry(Entry* entry, qint64 now)
+    {
+        qint64 deadline = qMax(now, qMax(laneTails.value(QString{}), pausedUntil(QString{}, entry->priority)));
+        if (entry->deviceIDs.isEmpty()) {
+            for (qint64 tail : qAsConst(laneTails)) {
+                deadline = qMax(deadline, tail);
+            }
+            deadline = qMax(deadline, latestPause(entry->priority));
+            laneTails[QString{}] = deadline + entryDuration(entry);
+        } else {
+            for (const QString& deviceID : qAsConst(entry->deviceIDs)) {
+                deadline = qMax(deadline, qMax(laneTails.value(deviceID), pausedUntil(deviceID, entry->priority)));
+            }
+            for (const QString& deviceID : qAsConst(entry->deviceIDs)) {
+                laneTails[deviceID] = deadline + entryDuration(entry);
+            }
+        }
+        entry->deadline = deadline;
+    }
+
+    // Recalculate the deadlines of all the queued entries, for when the queue has been
+    // rearranged, or something has run for longer than it was planned to
+    void plan()
+    {
+        const qint64 now = epoch.elapsed();
+        laneTails = laneBusyUntil;
+        for (Entry* entry : qAsConst(commands)) {
+            planEntry(entry, now);
+        }
+        schedule();
+    }
+
+    void schedule()
     {
-        // only pop if there's commands left
-        if(commands.count() > 0) {
-            Entry* entry = commands.takeFirst();
-
-            // Command can be empty if it's a pause (possibly others as well,
-            // though not yet, but just never send an empty command)
-            if(!entry->command.command.isEmpty()) {
-                connectionManager->sendMessage(entry->command.command, entry->deviceIDs);
-                currentCommandTimer->setInterval(entry->command.duration + entry->command.minimumCooldown);
-                currentCommandTimer->start();
-                currentCommandTimerChecker->start();
-                emit q->currentCommandTotalDurationChanged(currentCommandTimer->interval());
-                emit q->currentCommandRemainingMSecondsChanged(currentCommandTimer->remainingTime());
+        if (commands.isEmpty()) {
+            popTimer->stop();
+            return;
+        }
+        qint64 nextDeadline = commands.first()->deadline;
+        for (const Entry* entry : qAsConst(commands)) {
+            nextDeadline = qMin(nextDeadline, entry->deadline);
+        }
+        popTimer->start(int(qMax<qint64>(0, nextDeadline - epoch.elapsed())));
+    }
+
+    bool isLaneFree(const Entry* entry, qint64 now) const
+    {
+        if (laneBusyUntil.value(QString{}) > now || pausedUntil(QString{}, entry->priority) > now) {
+            return false;
+        }
+        if (entry->deviceIDs.isEmpty()) {
+            for (qint64 busyUntil : laneBusyUntil) {
+                if (busyUntil > now) {
+                    return false;
+                }
+            }
+            if (latestPause(entry->priority) > now) {
+                return false;
+            }
+        } else {
+            for (const QString& deviceID : entry->deviceIDs) {
+                if (laneBusyUntil.value(deviceID) > now || pausedUntil(deviceID, entry->priority) > now) {
+                    return false;
+                }
             }
+        }
+        return true;
+    }
+
+    // Launch the entry, and returns true if the entries after it need to be planned again,
+    // either because its lanes will be busy for longer than was planned, or because it was
+    // a pause (which was planned into the lane tails along with the commands, but now only
+    // holds up the entries it is supposed to, through lanePauses)
+    bool run(Entry* entry, qint64 now)
+    {
+        // Command can be empty if it's a pause (possibly others as well,
+        // though not yet, but just never send an empty command)
+        if(!entry->command.command.isEmpty()) {
+            connectionManager->sendMessage(entry->command.command, entry->deviceIDs);
+            currentCommandStartTimestamp = QDateTime::currentMSecsSinceEpoch();
+            currentCommandEndTimestamp = currentCommandStartTimestamp + entryDuration(entry);
+            emit q->currentCommandStartTimestampChanged(currentCommandStartTimestamp);
+            emit q->currentCommandEndTimestampChanged(currentCommandEndTimestamp);
+            emit q->currentCommandTotalDurationChanged(q->currentCommandTotalDuration());
+        }
 
-            popTimer->start(entry->command.duration + entry->command.minimumCooldown);
+        if (!entry->command.command.isEmpty()) {
+            WaitTimes& wait = waitTimes[entry->priority];
+            const int waited = int(now - entry->enqueued);
+            wait.total += waited;
+            ++wait.samples;
+            wait.maximum = qMax(wait.maximum, waited);
+        }
 
+        lastLateness = int(now - entry->deadline);
+        maximumLateness = qMax(maximumLateness, lastLateness);
+        totalLateness += lastLateness;
+        ++latenessSamples;
+
+        // The lanes are busy until the planned end of the entry, so lateness in getting
+        // around to launching it is soaked up by its cooldown, rather than pushing every
+        // later entry back. We will never start the next entry while this one is still
+        // running, though, no matter how late we were.
+        const qint64 plannedEnd = entry->deadline + entryDuration(entry);
+        const qint64 busyUntil = qMax(plannedEnd, now + entry->command.duration);
+        const QStringList lanes = entry->deviceIDs.isEmpty() ? QStringList{QString{}} : entry->deviceIDs;
+        for (const QString& lane : lanes) {
+            if (entry->command.command.isEmpty()) {
+                Pause& pause = lanePauses[lane];
+                pause.until = busyUntil;
+                pause.priority = entry->priority;
+            } else {
+                laneBusyUntil[lane] = busyUntil;
+            }
+        }
+        const bool replan = entry->command.command.isEmpty() || busyUntil > plannedEnd;
+        delete entry;
+        return replan;
+    }
+
+    void pop()
+    {
+        // Launch every entry whose deadline has been reached. The deadlines already take
+        // care of the ordering within each lane, and of entries for several devices
+        // waiting until all of those devices have caught up (the sync point).
+        const qint64 now = epoch.elapsed();
+        bool popped{false};
+        bool overran{false};
+        int i = 0;
+        while (i < commands.count()) {
+            Entry* entry = commands.at(i);
+            if (entry->deadline <= now && isLaneFree(entry, now)) {
+                commands.removeAt(i);
+                overran = run(entry, now) || overran;
+                popped = true;
+            } else {
+                ++i;
+            }
+        }
+
+        if (popped) {
+            emit q->lastLatenessChanged(lastLateness);
+            emit q->maximumLatenessChanged(maximumLateness);
+            emit q->averageLatenessChanged(q->averageLateness());
+            emit q->averageWaitTimesChanged(q->averageWaitTimes());
+            emit q->maximumWaitTimesChanged(q->maximumWaitTimes());
             emit q->countChanged(q->count());
-            delete entry;
+        }
+        if (overran) {
+            plan();
+        } else {
+            schedule();
+        }
+    }
+
+    // Add the entry after everything else of the same or a higher priority
+    void append(Entry* entry, int priority)
+    {
+        const qint64 now = epoch.elapsed();
+        entry->priority = priority;
+        entry->enqueued = now;
+        int position = commands.count();
+        while (position > 0 && commands.at(position - 1)->priority > priority) {
+            --position;
+        }
+        commands.insert(position, entry);
+        if (!entry->command.command.isEmpty()) {
+            QStringList deviceIDs = entry->deviceIDs;
+            if (deviceIDs.isEmpty()) {
+                BTDeviceModel* deviceModel = qobject_cast<BTDeviceModel*>(connectionManager->deviceModel());
+                for (int i = 0; i < deviceModel->count(); ++i) {
+                    deviceIDs << deviceModel->getDeviceById(i)->deviceID();
+                }
+            }
+            CommandLatency::getInstance()->commandQueued(entry->command.command, deviceIDs);
+        }
+        if (position == commands.count() - 1) {
+            planEntry(entry, now);
+        } else {
+            // It went ahead of something, which then has to be planned again
+            plan();
         }
     }
 };
@@ -87,13 +315,6 @@ CommandQueue::CommandQueue(BTConnectionManager* connectionManager)
     : CommandQueueProxySource(connectionManager)
     , d(new Private(this, connectionManager))
 {
-    d->popTimer = new QTimer(this);
-    d->popTimer->setSingleShot(true);
-    connect(d->popTimer, &QTimer::timeout, this, [this](){ d->pop(); });
-
-    connect(d->currentCommandTimerChecker, &QTimer::timeout, [this](){
-        emit currentCommandRemainingMSecondsChanged(d->currentCommandTimer->remainingTime());
-    });
 }
 
 CommandQueue::~CommandQueue()
@@ -158,31 +379,122 @@ int CommandQueue::count() const
     return d->commands.count();
 }
 
-int CommandQueue::currentCommandRemainingMSeconds() const
+qint64 CommandQueue::currentCommandStartTimestamp() const
+{
+    return d->currentCommandStartTimestamp;
+}
+
+qint64 CommandQueue::currentCommandEndTimestamp() const
 {
-    return d->currentCommandTimer->remainingTime();
+    return d->currentCommandEndTimestamp;
 }
 
 int CommandQueue::currentCommandTotalDuration() const
 {
-    return d->currentCommandTimer->interval();
+    return int(d->currentCommandEndTimestamp - d->currentCommandStartTimestamp);
+}
+
+int CommandQueue::lastLateness() const
+{
+    return d->lastLateness;
+}
+
+int CommandQueue::averageLateness() const
+{
+    if (d->latenessSamples > 0) {
+        return int(d->totalLateness / d->latenessSamples);
+    }
+    return 0;
+}
+
+int CommandQueue::maximumLateness() const
+{
+    return d->maximumLateness;
+}
+
+QVariantList CommandQueue::averageWaitTimes() const
+{
+    QVariantList waitTimes;
+    for (const Private::WaitTimes& wait : d->waitTimes) {
+        waitTimes << (wait.samples > 0 ? int(wait.total / wait.samples) : 0);
+    }
+    return waitTimes;
+}
+
+QVariantList CommandQueue::maximumWaitTimes() const
+{
+    QVariantList waitTimes;
+    for (const Private::WaitTimes& wait : d->waitTimes) {
+        waitTimes << wait.maximum;
+    }
+    return waitTimes;
+}
+
+int CommandQueue::count(Priority priority) const
+{
+    int count{0};
+    for (const Private::Entry* entry : qAsConst(d->commands)) {
+        if (entry->priority == priority) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+void CommandQueue::removeEntries(Priority priority)
+{
+    QMutableVectorIterator<Private::Entry*> it(d->commands);
+    while (it.hasNext()) {
+        Private::Entry* entry = it.next();
+        if (entry->priority == priority) {
+            if (!entry->command.command.isEmpty()) {
+                CommandLatency::getInstance()->commandDropped(entry->command.command, entry->deviceIDs);
+            }
+            delete entry;
+            it.remove();
+        }
+    }
+    d->plan();
+    emit countChanged(count());
 }
 
 void CommandQueue::clear(const QString& deviceID)
 {
-    // Before doing anything else, ensure the timer doesn't suddenly pick stuff
+    // Before doing anything else, ensure the timers don't suddenly pick stuff
     // out from underneath us. Stop all functions and let's do the thing.
-    d->popTimer->stop();
+    CommandLatency::getInstance()->forgetPending(deviceID);
     if (deviceID.isEmpty()) {
+        d->popTimer->stop();
+        d->laneBusyUntil.clear();
+        d->lanePauses.clear();
+        d->laneTails.clear();
+        qDeleteAll(d->commands);
         d->commands.clear();
     } else {
+        d->laneBusyUntil.remove(deviceID);
+        d->lanePauses.remove(deviceID);
         // Remove the command, but only if the command is requested for only that device
         // If the command is requested for other devices as well, remove this device from the list of requesting devices
+        QMutableVectorIterator<Private::Entry*> it(d->commands);
+        while (it.hasNext()) {
+            Private::Entry* entry = it.next();
+            if (entry->deviceIDs.removeAll(deviceID) > 0 && entry->deviceIDs.isEmpty()) {
+                delete entry;
+                it.remove();
+            }
+        }
+        // Entries which were waiting on this device to sync up may now be able to go
+        d->plan();
     }
     emit countChanged(count());
 }
 
 void CommandQueue::pushPause(int durationMilliseconds, QStringList devices)
+{
+    pushPause(durationMilliseconds, devices, MoveListPriority);
+}
+
+void CommandQueue::pushPause(int durationMilliseconds, QStringList devices, Priority priority)
 {
     qDebug() << "Adding a pause to the queue of" << durationMilliseconds << "milliseconds";
     CommandInfo command;
@@ -191,65 +503,74 @@ void CommandQueue::pushPause(int durationMilliseconds, QStringList devices)
 
     Private::Entry* entry = new Private::Entry(command);
     entry->deviceIDs = devices;
-    d->commands.append(entry);
+    d->append(entry, priority);
     emit countChanged(count());
 
-    // If we have just pushed a command and the timer is not currently running,
-    // let's fire one off now!
-    if(!d->popTimer->isActive()) {
-        d->pop();
-    }
+    // If we have just pushed a command and its lanes are not currently busy,
+    // its deadline is now, so let's fire it off!
+    d->pop();
 }
 
 void CommandQueue::pushCommand(QString tailCommand, QStringList devices)
+{
+    pushCommand(tailCommand, devices, MoveListPriority);
+}
+
+void CommandQueue::pushCommand(QString tailCommand, QStringList devices, Priority priority)
 {
     qDebug() << Q_FUNC_INFO << tailCommand;
-    const CommandInfo& command = qobject_cast<BTDeviceCommandModel*>(d->connectionManager->commandModel())->getCommand(tailCommand);
-    qDebug() << "Command to push" << command.command;
-    if(!command.isValid()) {
+    const CommandInfo* command = qobject_cast<BTDeviceCommandModel*>(d->connectionManager->commandModel())->findCommand(tailCommand);
+    if(!command || !command->isValid()) {
         return;
     }
-    Private::Entry* entry = new Private::Entry(command);
+    qDebug() << "Command to push" << command->command;
+    Private::Entry* entry = new Private::Entry(*command);
     entry->deviceIDs = devices;
-    d->commands.append(entry);
+    d->append(entry, priority);
     emit countChanged(count());
 
-    // If we have just pushed a command and the timer is not currently running,
-    // let's fire one off now!
-    if(!d->popTimer->isActive()) {
-        d->pop();
-    }
+    // If we have just pushed a command and its lanes are not currently busy,
+    // its deadline is now, so let's fire it off!
+    d->pop();
 }
 
 void CommandQueue::pushCommands(CommandInfoList commands, QStringList devices)
+{
+    pushCommands(commands, devices, MoveListPriority);
+}
+
+void CommandQueue::pushCommands(CommandInfoList commands, QStringList devices, Priority priority)
 {
     if(commands.count() > 0) {
         for (const CommandInfo& command : commands) {
             Private::Entry* entry = new Private::Entry(command);
             entry->deviceIDs = devices;
-            d->commands.append(entry);
+            d->append(entry, priority);
         }
         emit countChanged(count());
 
-        // If we have just pushed some commands and the timer is not currently
-        // running, let's fire one off now!
-        if(!d->popTimer->isActive()) {
-            d->pop();
-        }
+        // If we have just pushed some commands and their lanes are not
+        // currently busy, the first deadline is now, so let's fire one off!
+        d->pop();
     }
 }
 
 void CommandQueue::pushCommands(QStringList commands, QStringList devices)
+{
+    pushCommands(commands, devices, MoveListPriority);
+}
+
+void CommandQueue::pushCommands(QStringList commands, QStringList devices, Priority priority)
 {
     qDebug() << commands;
     for (auto command : commands) {
         if(command.startsWith("pause")) {
             QStringList pauseCommand = command.split(':');
             if(pauseCommand.count() == 2) {
-                pushPause(pauseCommand[1].toInt() * 1000, devices);
+                pushPause(pauseCommand[1].toInt() * 1000, devices, priority);
             }
         } else {
-            pushCommand(command, devices);
+            pushCommand(command, devices, priority);
         }
     }
 }
@@ -257,16 +578,24 @@ void CommandQueue::pushCommands(QStringList commands, QStringList devices)
 void CommandQueue::removeEntry(int index)
 {
     d->commands.removeAt(index);
+    d->plan();
     emit countChanged(count());
 }
 
 void CommandQueue::swapEntries(int swapThis, int withThis)
 {
     if(swapThis >= 0 && swapThis < d->commands.count() && withThis >= 0 && withThis < d->commands.count()) {
+        // The queue is kept sorted by priority (which append() relies on), so entries
+        // can only be moved around among others of the same priority
+        if (d->commands.at(swapThis)->priority != d->commands.at(withThis)->priority) {
+            qDebug() << "Not swapping entries" << swapThis << "and" << withThis << "as they have different priorities";
+            return;
+        }
         Private::Entry* with = d->commands.takeAt(withThis);
         Private::Entry* swap = d->commands.takeAt(swapThis);
         d->commands.insert(swapThis, with);
         d->commands.insert(withThis, swap);
+        d->plan();
     }
 }
 
@@ -35,6 +35,20 @@ class BTConnectionManager;
  * one ended, or with a given pause before the next is launched. This ensures that
  * the tail will not likely end up with the kind of damage which might otherwise
  * occur if we allowed commands to simply be fired off without a cooldown period.
+ *
+ * Each device has its own lane in the queue, so a command or pause aimed at one
+ * device does not hold up the commands aimed at other devices. Entries sent to
+ * several devices wait until all of those devices have caught up, and entries
+ * sent to all devices (that is, with an empty device list) wait for everything
+ * queued before them, and hold up everything queued after them.
+ *
+ * Entries also have a priority, and are planned in order of their priority first,
+ * and only then the order they were added in. An entry will still wait for whatever
+ * is already running on its devices to finish (including the command's cooldown),
+ * but goes ahead of anything of a lower priority which has not yet been launched.
+ * Entries added through the slots (that is, by the user) are given MoveListPriority.
+ * A pause only ever holds up entries of its own or a lower priority, so for example
+ * a gesture is sent straight away, even while casual mode is pausing between moves.
  */
 class CommandQueue : public CommandQueueProxySource
 {
@@ -52,25 +66,84 @@ public:
         MinimumCooldown
     };
 
+    enum Priority {
+        GesturePriority = 0, ///< Commands triggered interactively by gestures
+        AlarmPriority, ///< Commands sent by alarms
+        MoveListPriority, ///< Commands sent by the user, such as move lists (the default)
+        CasualPriority, ///< Commands sent in the background by casual mode
+        PriorityCount
+    };
+
     QHash< int, QByteArray > roleNames() const;
     QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const;
     int rowCount(const QModelIndex& parent = QModelIndex()) const;
     int count() const override;
 
     /**
-     * The number of remaining milliseconds of the most recently launched command
-     * launched by the queue. If this is zero, consider no command running.
+     * The time at which the most recently launched command was launched by the queue,
+     * in milliseconds since the unix epoch.
+     * This is only updated once per command, so to find the remaining time of the command,
+     * compare currentCommandEndTimestamp() to the current time locally.
+     * @return The time the current command was launched
+     */
+    qint64 currentCommandStartTimestamp() const override;
+    /**
+     * The time at which the most recently launched command will be done, in milliseconds
+     * since the unix epoch. If this is in the past, consider no command running.
      * @note This also includes the mandatory pause of the command
-     * @return The remaining runtime of the current command in milliseconds
+     * @return The time at which the current command will be done
      */
-    int currentCommandRemainingMSeconds() const override;
+    qint64 currentCommandEndTimestamp() const override;
     /**
      * The number of milliseconds the current command will run for.
      * @Note, this is not updated until the next command is launched, and not included for pauses.
      */
     int currentCommandTotalDuration() const override;
+    /**
+     * How many milliseconds after its deadline the most recently launched entry
+     * was actually launched. Every entry is given an absolute deadline when it is
+     * added to the queue, and the lateness is a measure of how well we keep up.
+     */
+    int lastLateness() const override;
+    /**
+     * The average lateness of all the entries launched by the queue so far
+     * @see lastLateness()
+     */
+    int averageLateness() const override;
+    /**
+     * The highest lateness of any entry launched by the queue so far
+     * @see lastLateness()
+     */
+    int maximumLateness() const override;
+    /**
+     * The average time entries of each priority have waited in the queue before
+     * being launched, in milliseconds, indexed by Priority. Only entries with commands
+     * are counted (that is, pauses are not).
+     */
+    QVariantList averageWaitTimes() const override;
+    /**
+     * The longest time any entry of each priority has waited in the queue before
+     * being launched, in milliseconds, indexed by Priority
+     * @see averageWaitTimes()
+     */
+    QVariantList maximumWaitTimes() const override;
+    /**
+     * The number of entries of the given priority in the queue
+     * @param priority The priority of the entries to count
+     */
+    int count(Priority priority) const;
+    /**
+     * Remove all the entries of the given priority which have not yet been launched
+     * @param priority The priority of the entries to remove
+     */
+    void removeEntries(Priority priority);
     /**
      * Clear the queue of all commands
+     *
+     * If a device ID is given, only the commands for that device are removed (commands
+     * sent to that device and others will still be sent to the others), and the lane
+     * for that device is reset.
+     * @param deviceID The device to clear commands for (or an empty string to clear everything)
      */
     Q_SLOT void clear(const QString& deviceID) override;
     /**
@@ -80,6 +153,11 @@ public:
      * @param devices The devices you wish to send the commands to (or an empty list to send to all devices)
      */
     Q_SLOT void pushPause(int durationMilliseconds, QStringList devices) override;
+    /**
+     * Add a pause to the queue, after the other entries of the given priority
+     * @see pushPause(int, QStringList)
+     */
+    void pushPause(int durationMilliseconds, QStringList devices, Priority priority);
     /**
      * Add a specific command to the end of the queue. If there are no commands
      * currently running, the command will be run immediately.
@@ -88,6 +166,11 @@ public:
      * @param devices The devices you wish to send the commands to (or an empty list to send to all devices)
      */
     Q_SLOT void pushCommand(QString tailCommand, QStringList devices) override;
+    /**
+     * Add a command to the queue, after the other entries of the given priority
+     * @see pushCommand(QString, QStringList)
+     */
+    void pushCommand(QString tailCommand, QStringList devices, Priority priority);
     /**
      * A convenient way of adding a whole list of commands to the queue in one go.
      * As with adding a single command, if nothing is currently running, once the
@@ -97,6 +180,7 @@ public:
      * @param devices The devices you wish to send the commands to (or an empty list to send to all devices)
      */
     Q_SLOT void pushCommands(CommandInfoList commands, QStringList deviceIDs);
+    void pushCommands(CommandInfoList commands, QStringList deviceIDs, Priority priority);
     /**
      * A convenience slot which takes a list of commands, and the special pause command
      * (which is "pause:" followed by an integer number representing the number of seconds
@@ -105,6 +189,7 @@ public:
      * @param devices The devices you wish to send the commands to (or an empty list to send to all devices)
      */
     Q_SLOT void pushCommands(QStringList commands, QStringList deviceIDs) override;
+    void pushCommands(QStringList commands, QStringList deviceIDs, Priority priority);
     /**
      * Remove a specific command from the queue
      *
@@ -116,6 +201,7 @@ public:
      *
      * @param swapThis The first command (which will end up at the original position of withThis)
      * @param withThis The second command (which will end up at the original position of swapThis)
+     * @note The queue is kept ordered by priority, so this does nothing if the two entries have different priorities
      */
     Q_SLOT void swapEntries(int swapThis, int withThis) override;
     /**
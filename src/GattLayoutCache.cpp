@@ -0,0 +1,153 @@
+/*
+ *   Copyright 2021 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#include "GattLayoutCache.h"
+
+#include <QDebug>
+#include <QHash>
+#include <QLowEnergyService>
+#include <QSettings>
+
+class GattLayoutCache::Private
+{
+public:
+    Private() {}
+    ~Private() {}
+
+    struct Device {
+        QString firmware;
+        // Each layout is a sorted list of the characteristics (with their properties)
+        // and descriptors of the service, which is quick to compare and to store
+        QHash<QBluetoothUuid, QStringList> layouts;
+    };
+    QHash<QString, Device> devices;
+
+    static QString deviceGroup(const QString& deviceID)
+    {
+        return QString{"GattLayouts/%1"}.arg(deviceID);
+    }
+
+    static QString firmwareGroup(const QString& deviceID, const QString& firmware)
+    {
+        // The firmware version is whatever the device told us, so make sure it won't be mistaken for more levels of grouping
+        return QString{"%1/%2"}.arg(deviceGroup(deviceID)).arg(QString(firmware).replace('/', '_').replace('\\', '_'));
+    }
+
+    static QStringList describe(const QLowEnergyService* service)
+    {
+        QStringList layout;
+        for (const QLowEnergyCharacteristic& characteristic : service->characteristics()) {
+            const QString characteristicID = characteristic.uuid().toString();
+            layout << QString{"%1 %2"}.arg(characteristicID).arg(int(characteristic.properties()));
+            for (const QLowEnergyDescriptor& descriptor : characteristic.descriptors()) {
+                layout << QString{"%1/%2"}.arg(characteristicID).arg(descriptor.uuid().toString());
+            }
+        }
+        layout.sort();
+        return layout;
+    }
+
+    Device& device(const QString& deviceID)
+    {
+        QHash<QString, Device>::iterator device = devices.find(deviceID);
+        if (device == devices.end()) {
+            device = devices.insert(deviceID, Device());
+            QSettings settings;
+            device.value().firmware = settings.value(QString{"%1/firmware"}.arg(deviceGroup(deviceID))).toString();
+            settings.beginGroup(firmwareGroup(deviceID, device.value().firmware));
+            for (const QString& service : settings.childKeys()) {
+                device.value().layouts[QBluetoothUuid(service)] = settings.value(service).toStringList();
+            }
+            settings.endGroup();
+        }
+        return device.value();
+    }
+
+    void save(const QString& deviceID, const Device& device)
+    {
+        QSettings settings;
+        settings.remove(deviceGroup(deviceID));
+        settings.setValue(QString{"%1/firmware"}.arg(deviceGroup(deviceID)), device.firmware);
+        settings.beginGroup(firmwareGroup(deviceID, device.firmware));
+        for (QHash<QBluetoothUuid, QStringList>::const_iterator layout = device.layouts.constBegin(); layout != device.layouts.constEnd(); ++layout) {
+            settings.setValue(layout.key().toString(), layout.value());
+        }
+        settings.endGroup();
+    }
+};
+
+GattLayoutCache::GattLayoutCache()
+    : d(new Private)
+{
+}
+
+GattLayoutCache::~GattLayoutCache()
+{
+    delete d;
+}
+
+bool GattLayoutCache::hasLayout(const QString& deviceID, const QBluetoothUuid& service) const
+{
+    return d->device(deviceID).layouts.contains(service);
+}
+
+bool GattLayoutCache::matches(const QString& deviceID, const QLowEnergyService* service) const
+{
+    const Private::Device& device = d->device(deviceID);
+    QHash<QBluetoothUuid, QStringList>::const_iterator layout = device.layouts.constFind(service->serviceUuid());
+    return layout != device.layouts.constEnd() && layout.value() == Private::describe(service);
+}
+
+void GattLayoutCache::store(const QString& deviceID, const QLowEnergyService* service)
+{
+    const QStringList layout = Private::describe(service);
+    if (layout.isEmpty()) {
+        // Nothing worth remembering, and most likely the details were not discovered after all
+        return;
+    }
+    Private::Device& device = d->device(deviceID);
+    if (device.layouts.value(service->serviceUuid()) != layout) {
+        qDebug() << deviceID << "Storing the layout of service" << service->serviceUuid() << "for firmware" << device.firmware;
+        device.layouts[service->serviceUuid()] = layout;
+        d->save(deviceID, device);
+    }
+}
+
+void GattLayoutCache::setFirmware(const QString& deviceID, const QString& firmware)
+{
+    Private::Device& device = d->device(deviceID);
+    if (device.firmware != firmware) {
+        if (device.firmware.isEmpty()) {
+            qDebug() << deviceID << "Firmware is" << firmware;
+        } else {
+            qDebug() << deviceID << "Firmware changed from" << device.firmware << "to" << firmware << "so forgetting the service layouts";
+            device.layouts.clear();
+        }
+        device.firmware = firmware;
+        d->save(deviceID, device);
+    }
+}
+
+void GattLayoutCache::discoverDetails(QLowEnergyService* service, bool layoutKnown)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 2, 0)
+    service->discoverDetails(layoutKnown ? QLowEnergyService::SkipValueDiscovery : QLowEnergyService::FullDiscovery);
+#else
+    Q_UNUSED(layoutKnown)
+    service->discoverDetails();
+#endif
+}
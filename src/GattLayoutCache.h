@@ -0,0 +1,98 @@
+/*
+ *   Copyright 2021 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#ifndef GATTLAYOUTCACHE_H
+#define GATTLAYOUTCACHE_H
+
+#include <QBluetoothUuid>
+#include <QString>
+
+class QLowEnergyService;
+
+/**
+ * Remembers the layout (characteristics and their descriptors) of the services
+ * on the devices we have connected to, per device address and firmware version,
+ * across runs of the application.
+ *
+ * The firmware version of a device is only known once we have connected to it,
+ * so layouts are looked up using the firmware version the device reported last
+ * time, and once the device reports its version, setFirmware() is used to tell
+ * the cache about it. A layout found in the cache is only a hint (a device might
+ * have been updated by something other than us), and must always be checked with
+ * matches() once the service details are known.
+ *
+ * When the layout of a service is known, discoverDetails() skips reading the values
+ * of its characteristics and descriptors, which is most of the time spent discovering
+ * the details of a service.
+ */
+class GattLayoutCache
+{
+public:
+    ~GattLayoutCache();
+
+    static GattLayoutCache* getInstance() {
+        static GattLayoutCache* instance = nullptr;
+        if(!instance) {
+            instance = new GattLayoutCache();
+        }
+        return instance;
+    }
+
+    /**
+     * Whether we know the layout of the given service on the given device
+     * @param deviceID The address of the device
+     * @param service The UUID of the service
+     */
+    bool hasLayout(const QString& deviceID, const QBluetoothUuid& service) const;
+    /**
+     * Whether the details of the service match the layout we have for it
+     * @param deviceID The address of the device
+     * @param service A service whose details have been discovered
+     * @return True if the layout is known and matches, otherwise false
+     */
+    bool matches(const QString& deviceID, const QLowEnergyService* service) const;
+    /**
+     * Remember the layout of the service, replacing any layout we had for it
+     * @param deviceID The address of the device
+     * @param service A service whose details have been discovered
+     */
+    void store(const QString& deviceID, const QLowEnergyService* service);
+    /**
+     * Tell the cache which firmware version the device is running. If this is different
+     * from the version we last saw, the layouts stored for the old version are dropped,
+     * and the next connection discovers everything in full again. If we did not know the
+     * version before (that is, this is the first time we connect to the device), the
+     * layouts stored during this connection are kept for this version.
+     * @param deviceID The address of the device
+     * @param firmware The version reported by the device
+     */
+    void setFirmware(const QString& deviceID, const QString& firmware);
+    /**
+     * Start discovering the details of the service. If the layout of the service is known,
+     * the values of its characteristics and descriptors are not read during discovery
+     * (which requires Qt 6.2 or later, and before that the discovery is always done in full).
+     * @param service The service to discover the details of
+     * @param layoutKnown Whether the layout of the service is in the cache
+     */
+    static void discoverDetails(QLowEnergyService* service, bool layoutKnown);
+private:
+    GattLayoutCache();
+    class Private;
+    Private* d;
+};
+
+#endif//GATTLAYOUTCACHE_H
@@ -20,6 +20,7 @@
 #include "BTDeviceCommandModel.h"
 #include "BTDeviceModel.h"
 #include "BTDevice.h"
+#include "CommandQueue.h"
 #include "GestureDetectorModel.h"
 #include "WalkingSensorGestureReconizer.h"
 
@@ -67,10 +68,12 @@ public:
         GestureDetails* gesture = model->gesture(gestureId);
         if (gesture && !gesture->command().isEmpty() && gesture->sensorEnabled()) {
             qDebug() << "We have a gesture with a command set, send that to our required devices, which are (empty means all):" << gesture->devices();
+            CommandQueue* queue = qobject_cast<CommandQueue*>(connectionManager->commandQueue());
             BTDeviceModel* deviceModel = qobject_cast<BTDeviceModel*>(connectionManager->deviceModel());
             // First get the command from the core model...
             BTDeviceCommandModel* commandModel = qobject_cast<BTDeviceCommandModel*>(connectionManager->commandModel());
             CommandInfo cmd = commandModel->getCommand(gesture->command());
+            QStringList targetDevices;
             for (int i = 0 ; i < deviceModel->count() ; ++i) {
                 BTDevice* device = deviceModel->getDeviceById(i);
                 qDebug() << device->deviceID() << "of class type" << device->metaObject()->className() << "is connected?" << device->isConnected() << "is the command available?" << device->commandModel->isAvailable(cmd) << "with the command being" << cmd.command << "and is supposed to be a recipient of this command?" << (gesture->devices().count() == 0 || gesture->devices().contains(device->deviceID()));
@@ -78,9 +81,18 @@ public:
                 // and that it's supposed to be a recipient
                 if (device->isConnected() && device->commandModel->isAvailable(cmd)
                     && (gesture->devices().count() == 0 || gesture->devices().contains(device->deviceID()))) {
-                    device->sendMessage(gesture->command());
+                    targetDevices << device->deviceID();
                 }
             }
+            if (targetDevices.count() > 0) {
+                if (queue->count(CommandQueue::GesturePriority) > 0) {
+                    // Gestures tend to come in bursts (such as when walking), and we don't want to
+                    // build up a backlog of them, so the newest gesture replaces any still waiting
+                    qDebug() << "Replacing the gesture already waiting in the queue with" << gestureId;
+                    queue->removeEntries(CommandQueue::GesturePriority);
+                }
+                queue->pushCommand(gesture->command(), targetDevices, CommandQueue::GesturePriority);
+            }
         }
     }
 };
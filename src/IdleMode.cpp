@@ -68,10 +68,10 @@ public:
                             }
                         }
                         if (targetDevices.length() > 0) {
-                            queue->pushCommand(command.command, targetDevices);
+                            queue->pushCommand(command.command, targetDevices, CommandQueue::CasualPriority);
                         }
                     }
-                    queue->pushPause(QRandomGenerator::global()->bounded(appSettings->idleMinPause(), appSettings->idleMaxPause() + 1) * 1000, {});
+                    queue->pushPause(QRandomGenerator::global()->bounded(appSettings->idleMinPause(), appSettings->idleMaxPause() + 1) * 1000, {}, CommandQueue::CasualPriority);
                 }
             }
         }
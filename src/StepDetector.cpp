@@ -0,0 +1,257 @@
+/*
+ *   Copyright 2021 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#include "StepDetector.h"
+
+namespace {
+    const qreal gravity{9.8};
+    // If there is more than this long (in microseconds) between two readings, we start over
+    const quint64 maximumSampleGap{500000};
+    // The windows below are sized for the 30Hz the accelerometer is asked to deliver readings
+    // at (see WalkingSensorGestureReconizer), to cover the same stretches of time as they did
+    // when the readings were sampled every 16ms:
+    // The number of filtered values the mean is taken over (about 650ms)
+    const int meanWindow{20};
+    // How long (in microseconds) after crossing zero the signal has to rise above the threshold
+    // in, which is measured using the timestamps, so it holds whatever the actual reading rate
+    const quint64 stepWindow{300000};
+    const qreal stepThreshold{0.3};
+
+    /**
+     * The median of the last Window values added, kept in two heaps (the lower half of the
+     * values in a max-heap, and the upper half in a min-heap), so the median is always found
+     * at the top of them. Once the window is full, each new value replaces the oldest one in
+     * whichever heap it is in, and is then sifted into place, so adding a value is O(log Window).
+     */
+    class RunningMedian
+    {
+    public:
+        // About 170ms worth of readings
+        static const int Window = 5;
+
+        void clear()
+        {
+            count = 0;
+            oldest = 0;
+            lowCount = 0;
+            highCount = 0;
+        }
+
+        bool isFull() const
+        {
+            return count == Window;
+        }
+
+        // Only valid once at least one value has been added
+        qreal median() const
+        {
+            if (count % 2) {
+                return values[low[0]];
+            }
+            return (values[low[0]] + values[high[0]]) / 2;
+        }
+
+        void add(qreal value)
+        {
+            if (count < Window) {
+                const int slot = count++;
+                values[slot] = value;
+                // The lower half holds the extra value when there is an odd number of them
+                const bool isLow = (lowCount == highCount);
+                const int index = isLow ? lowCount++ : highCount++;
+                place(isLow, index, slot);
+                siftUp(isLow, index);
+            } else {
+                const int slot = oldest;
+                oldest = (oldest + 1) % Window;
+                values[slot] = value;
+                siftUp(inLow[slot], heapIndex[slot]);
+                siftDown(inLow[slot], heapIndex[slot]);
+            }
+            // Changing a single value can at most leave the top of one heap on the wrong side of the other
+            if (lowCount > 0 && highCount > 0 && values[low[0]] > values[high[0]]) {
+                const int lowTop = low[0];
+                const int highTop = high[0];
+                place(true, 0, highTop);
+                place(false, 0, lowTop);
+                siftDown(true, 0);
+                siftDown(false, 0);
+            }
+        }
+    private:
+        qreal values[Window];
+        // Which heap each value is in, and where in it
+        bool inLow[Window];
+        int heapIndex[Window];
+        // The heaps hold the positions of the values in the values array
+        int low[Window];
+        int high[Window];
+        int lowCount{0};
+        int highCount{0};
+        int count{0};
+        int oldest{0};
+
+        // Whether the value in slot first belongs closer to the top of the heap than the one in slot second
+        bool above(bool isLow, int first, int second) const
+        {
+            return isLow ? values[first] > values[second] : values[first] < values[second];
+        }
+
+        void place(bool isLow, int index, int slot)
+        {
+            (isLow ? low : high)[index] = slot;
+            inLow[slot] = isLow;
+            heapIndex[slot] = index;
+        }
+
+        void swapEntries(bool isLow, int first, int second)
+        {
+            const int* heap = isLow ? low : high;
+            const int firstSlot = heap[first];
+            const int secondSlot = heap[second];
+            place(isLow, first, secondSlot);
+            place(isLow, second, firstSlot);
+        }
+
+        void siftUp(bool isLow, int index)
+        {
+            const int* heap = isLow ? low : high;
+            while (index > 0) {
+                const int parent = (index - 1) / 2;
+                if (!above(isLow, heap[index], heap[parent])) {
+                    break;
+                }
+                swapEntries(isLow, index, parent);
+                index = parent;
+            }
+        }
+
+        void siftDown(bool isLow, int index)
+        {
+            const int* heap = isLow ? low : high;
+            const int size = isLow ? lowCount : highCount;
+            while (true) {
+                int top = index;
+                const int left = 2 * index + 1;
+                const int right = left + 1;
+                if (left < size && above(isLow, heap[left], heap[top])) {
+                    top = left;
+                }
+                if (right < size && above(isLow, heap[right], heap[top])) {
+                    top = right;
+                }
+                if (top == index) {
+                    break;
+                }
+                swapEntries(isLow, index, top);
+                index = top;
+            }
+        }
+    };
+}
+
+class StepDetector::Private
+{
+public:
+    Private() {}
+    ~Private() {}
+
+    quint64 lastTimestamp{0};
+    RunningMedian median;
+
+    // The last meanWindow filtered values, and their sum
+    qreal filtered[meanWindow];
+    int filteredCount{0};
+    int oldestFiltered{0};
+    qreal filteredSum{0};
+
+    qreal previous{0};
+    // The time until which a step may be completed, after the signal crossed zero (or 0 if it may not)
+    quint64 stepDeadline{0};
+};
+
+StepDetector::StepDetector()
+    : d(new Private)
+{
+}
+
+StepDetector::~StepDetector()
+{
+    delete d;
+}
+
+bool StepDetector::addSample(quint64 timestamp, qreal zValue)
+{
+    if (d->lastTimestamp > 0 && timestamp > d->lastTimestamp + maximumSampleGap) {
+        reset();
+    }
+    d->lastTimestamp = timestamp;
+
+    // The filter looks at the readings before this one, so the new one only goes in afterwards
+    const bool haveMedian = d->median.isFull();
+    const qreal filtered = haveMedian ? d->median.median() : 0;
+    d->median.add(zValue - gravity);
+    if (!haveMedian) {
+        return false;
+    }
+
+    if (d->filteredCount < meanWindow) {
+        d->filtered[d->filteredCount++] = filtered;
+        d->filteredSum += filtered;
+        if (d->filteredCount < meanWindow) {
+            return false;
+        }
+    } else {
+        d->filteredSum += filtered - d->filtered[d->oldestFiltered];
+        d->filtered[d->oldestFiltered] = filtered;
+        d->oldestFiltered = (d->oldestFiltered + 1) % meanWindow;
+        if (d->oldestFiltered == 0) {
+            // Start the sum over once every time around, so rounding errors don't pile up
+            d->filteredSum = 0;
+            for (int i = 0; i < meanWindow; ++i) {
+                d->filteredSum += d->filtered[i];
+            }
+        }
+    }
+    const qreal value = filtered - d->filteredSum / meanWindow;
+
+    bool step{false};
+    if (d->previous < 0 && value > 0) {
+        d->stepDeadline = timestamp + stepWindow;
+    }
+    if (d->stepDeadline > 0) {
+        if (timestamp > d->stepDeadline) {
+            d->stepDeadline = 0;
+        } else if (value > stepThreshold) {
+            step = true;
+            d->stepDeadline = 0;
+        }
+    }
+    d->previous = value;
+    return step;
+}
+
+void StepDetector::reset()
+{
+    d->lastTimestamp = 0;
+    d->median.clear();
+    d->filteredCount = 0;
+    d->oldestFiltered = 0;
+    d->filteredSum = 0;
+    d->previous = 0;
+    d->stepDeadline = 0;
+}
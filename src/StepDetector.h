@@ -0,0 +1,58 @@
+/*
+ *   Copyright 2021 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#ifndef STEPDETECTOR_H
+#define STEPDETECTOR_H
+
+#include <QtGlobal>
+
+/**
+ * Finds steps in a stream of vertical acceleration readings, one reading at a time.
+ *
+ * Each reading (less gravity) goes through a running median filter over the five
+ * readings before it, and then has the running mean of the recent filtered values
+ * taken off. A step is when that signal crosses zero on its way up, and then goes
+ * on to rise above a threshold within the next 300ms.
+ *
+ * The cost of each reading is logarithmic in the size of the median window, and the
+ * detector does not allocate anything after construction.
+ */
+class StepDetector
+{
+public:
+    StepDetector();
+    ~StepDetector();
+
+    /**
+     * Feed the next reading to the detector. If there is a long gap between this reading
+     * and the one before it (because the sensor was not running in the meantime), the
+     * detector starts over rather than look for steps across the gap.
+     * @param timestamp When the reading was taken, in microseconds
+     * @param zValue The acceleration along the z axis in m/s², including gravity
+     * @return True if this reading completed a step, otherwise false
+     */
+    bool addSample(quint64 timestamp, qreal zValue);
+    /**
+     * Forget all the readings seen so far (for example when there was a gap in them)
+     */
+    void reset();
+private:
+    class Private;
+    Private* d;
+};
+
+#endif//STEPDETECTOR_H
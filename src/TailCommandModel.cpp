@@ -18,8 +18,10 @@
 #include "TailCommandModel.h"
 
 #include <QDebug>
-#include <QTimer>
 #include <QRandomGenerator>
+#include <QVarLengthArray>
+
+#include "TimerWheel.h"
 
 class TailCommandModel::Private
 {
@@ -27,8 +29,107 @@ public:
     Private() {}
     ~Private() {}
 
-    CommandInfoList commands;
-    QHash<QString,QTimer*> commandDeactivators;
+    // The commands themselves are held in lists shared with every other device which
+    // uses the same commands (see CommandCatalogue), and the only things we keep for
+    // ourselves are which of those commands are in which row, and their state
+    struct Row {
+        int list{0}; // the position of the list in lists
+        int index{0}; // the position of the command in that list
+        int id{-1}; // the interned id of the command (see intern())
+        bool isRunning{false};
+        bool isAvailable{true};
+    };
+    QVector<CommandInfoList> lists;
+    QVector<Row> rows;
+    // The fallbacks for marking commands as no longer running, by command id (see setRunning)
+    QHash<int,TimerWheel::Handle> commandDeactivators;
+
+    void cancelDeactivators()
+    {
+        for (const TimerWheel::Handle& handle : qAsConst(commandDeactivators)) {
+            TimerWheel::getInstance()->cancel(handle);
+        }
+        commandDeactivators.clear();
+    }
+
+    // Each distinct command string is given a small integer id when it is added to the
+    // model, so state changes (which arrive from the devices many times a second) do not
+    // have to look for the command by comparing strings
+    QHash<QString, int> ids;
+    // The same ids, keyed on the latin1 command, for looking up without allocating
+    QHash<QByteArray, int> latin1Ids;
+    // The row of each id (or -1 if no row currently has that command)
+    QVector<int> idRows;
+    // The command of each id
+    QVector<QString> idCommands;
+
+    // The commands in a group, and how many of those are currently running
+    struct Group {
+        QVector<int> rows;
+        int runningCount{0};
+    };
+    QHash<int, Group> groups;
+
+    const CommandInfo& command(const Row& row) const
+    {
+        return lists.at(row.list).at(row.index);
+    }
+
+    int intern(const QString& command)
+    {
+        int id = ids.value(command, -1);
+        if (id == -1) {
+            id = idRows.count();
+            ids.insert(command, id);
+            latin1Ids.insert(command.toLatin1(), id);
+            idRows << -1;
+            idCommands << command;
+        }
+        return id;
+    }
+
+    // Recalculate the rows of the ids and the groups, which is needed whenever rows
+    // are added or removed (which only happens when commands are loaded)
+    void rebuildIndex()
+    {
+        idRows.fill(-1);
+        groups.clear();
+        // Go backwards, so the first row with any given command wins
+        for (int i = rows.count() - 1; i > -1; --i) {
+            const Row& row = rows.at(i);
+            idRows[row.id] = i;
+        }
+        for (int i = 0; i < rows.count(); ++i) {
+            const Row& row = rows.at(i);
+            Group& group = groups[command(row).group];
+            group.rows << i;
+            if (row.isRunning) {
+                ++group.runningCount;
+            }
+        }
+    }
+
+    int rowOf(const QString& command) const
+    {
+        const int id = ids.value(command, -1);
+        return id > -1 ? idRows.at(id) : -1;
+    }
+
+    int rowOf(const CommandInfo& cmd) const
+    {
+        // The row with the same command is almost certainly the one, but there might
+        // in theory be more than one with the same command, so check properly
+        const int row = rowOf(cmd.command);
+        if (row == -1 || cmd.compare(command(rows.at(row)))) {
+            return row;
+        }
+        for (int i = 0; i < rows.count(); ++i) {
+            if (cmd.compare(command(rows.at(i)))) {
+                return i;
+            }
+        }
+        return -1;
+    }
 };
 
 TailCommandModel::TailCommandModel(QObject* parent)
@@ -38,6 +139,7 @@ TailCommandModel::TailCommandModel(QObject* parent)
 
 TailCommandModel::~TailCommandModel()
 {
+    d->cancelDeactivators();
     delete d;
 }
 
@@ -58,8 +160,9 @@ QHash< int, QByteArray > TailCommandModel::roleNames() const
 QVariant TailCommandModel::data(const QModelIndex& index, int role) const
 {
     QVariant value;
-    if(index.isValid() && index.row() > -1 && index.row() < d->commands.count()) {
-        const CommandInfo& command = d->commands.at(index.row());
+    if(index.isValid() && index.row() > -1 && index.row() < d->rows.count()) {
+        const Private::Row& row = d->rows.at(index.row());
+        const CommandInfo& command = d->command(row);
         switch(role) {
             case Name:
                 value = command.name;
@@ -68,7 +171,7 @@ QVariant TailCommandModel::data(const QModelIndex& index, int role) const
                 value = command.command;
                 break;
             case IsRunning:
-                value = command.isRunning;
+                value = row.isRunning;
                 break;
             case Category:
                 value = command.category;
@@ -83,7 +186,7 @@ QVariant TailCommandModel::data(const QModelIndex& index, int role) const
                 value = index.row();
                 break;
             case IsAvailable:
-                value = command.isAvailable;
+                value = row.isAvailable;
                 break;
             default:
                 break;
@@ -97,121 +200,180 @@ int TailCommandModel::rowCount(const QModelIndex& parent) const
     if(parent.isValid()) {
         return 0;
     }
-    return d->commands.count();
+    return d->rows.count();
 }
 
 void TailCommandModel::clear()
 {
     beginResetModel();
-    d->commands.clear();
+    d->rows.clear();
+    d->lists.clear();
+    d->groups.clear();
+    d->ids.clear();
+    d->latin1Ids.clear();
+    d->idRows.clear();
+    d->idCommands.clear();
+    d->cancelDeactivators();
     endResetModel();
 }
 
 void TailCommandModel::addCommand(const CommandInfo& command)
 {
+    Private::Row row;
+    row.list = d->lists.count();
+    row.id = d->intern(command.command);
+    row.isRunning = command.isRunning;
+    row.isAvailable = command.isAvailable;
+    d->lists << CommandInfoList{command};
     beginInsertRows(QModelIndex(), 0, 0);
-    d->commands.insert(0, command);
+    d->rows.insert(0, row);
+    d->rebuildIndex();
     emit commandAdded(command);
     endInsertRows();
 }
 
-void TailCommandModel::removeCommand(const CommandInfo& command)
+void TailCommandModel::addCommands(const CommandInfoList& commands)
 {
-    int idx{0};
-    bool found{false};
-    for (const CommandInfo& other : d->commands) {
-        if (command.compare(other)) {
-            found = true;
-            break;
-        }
-        ++idx;
+    if (commands.isEmpty()) {
+        return;
+    }
+    const int list = d->lists.count();
+    d->lists << commands;
+    // The commands end up in the same rows as they would if added one at a time
+    // using addCommand, that is, at the start of the model, with the last one first
+    QVector<Private::Row> newRows(commands.count());
+    for (int i = 0; i < commands.count(); ++i) {
+        const CommandInfo& command = commands.at(i);
+        Private::Row& row = newRows[commands.count() - 1 - i];
+        row.list = list;
+        row.index = i;
+        row.id = d->intern(command.command);
+        row.isRunning = command.isRunning;
+        row.isAvailable = command.isAvailable;
     }
-    if (found) {
+    beginInsertRows(QModelIndex(), 0, commands.count() - 1);
+    d->rows = newRows + d->rows;
+    d->rebuildIndex();
+    emit commandsAdded(commands);
+    endInsertRows();
+}
+
+void TailCommandModel::removeCommand(const CommandInfo& command)
+{
+    const int idx = d->rowOf(command);
+    if (idx > -1) {
         beginRemoveRows(QModelIndex(), idx, idx);
         emit commandRemoved(command);
-        d->commands.removeAt(idx);
+        d->rows.removeAt(idx);
+        d->rebuildIndex();
         endRemoveRows();
     }
 }
 
 void TailCommandModel::setRunning(const QString& command, bool isRunning)
 {
-//     qDebug() << "Command changing running state" << command << "being set to" << isRunning;
-    int i = -1;
-    for (CommandInfo& theCommand : d->commands) {
-        ++i;
-//         qDebug() << "Checking" << theCommand->command << "named" << theCommand->name;
-        if(theCommand.command == command) {
-//             qDebug() << "Found matching command!" << i;
-            if(theCommand.isRunning != isRunning) {
-//                 qDebug() << "Changing state";
-                QModelIndex idx = index(i, 0);
-                theCommand.isRunning = isRunning;
-                dataChanged(idx, idx, QVector<int>() << TailCommandModel::IsRunning << TailCommandModel::IsAvailable);
-
-                // ensure isAvailable is correct (check if any are running in our group, and set the availability accordingly)
-                bool hasAnyActive{false};
-                for (const CommandInfo& otherCommand : d->commands) {
-                    if (theCommand.group == otherCommand.group && otherCommand.isRunning) {
-                        hasAnyActive = true;
-                        break;
-                    }
-                }
-                int i2 = -1;
-                for (CommandInfo& otherCommand : d->commands) {
-                    ++i2;
-                    if (otherCommand.group == theCommand.group) {
-                        otherCommand.isAvailable = !hasAnyActive;
-                        QModelIndex idx2 = index(i2, 0);
-                        dataChanged(idx2, idx2, QVector<int>() << TailCommandModel::IsAvailable);
-                    }
+    setRunning(d->ids.value(command, -1), isRunning);
+}
+
+void TailCommandModel::setRunning(int commandId, bool isRunning)
+{
+//     qDebug() << "Command changing running state" << commandId << "being set to" << isRunning;
+    const int i = (commandId > -1 && commandId < d->idRows.count()) ? d->idRows.at(commandId) : -1;
+    if (i > -1) {
+        Private::Row& theRow = d->rows[i];
+        const CommandInfo& theCommand = d->command(theRow);
+        if(theRow.isRunning != isRunning) {
+            theRow.isRunning = isRunning;
+            // ensure isAvailable is correct (nothing in a group is available while anything in it is running)
+            Private::Group& group = d->groups[theCommand.group];
+            group.runningCount += isRunning ? 1 : -1;
+            const bool isAvailable = (group.runningCount == 0);
+            // The rows of a group are spread out through the model, so rather than one change
+            // covering everything from the first to the last of them, tell about each run of
+            // neighbouring rows which actually changed (the group's rows are in order, and
+            // include this one)
+            QVarLengthArray<int, 32> changedRows;
+            for (int groupRow : qAsConst(group.rows)) {
+                Private::Row& otherRow = d->rows[groupRow];
+                if (otherRow.isAvailable != isAvailable) {
+                    otherRow.isAvailable = isAvailable;
+                    changedRows.append(groupRow);
+                } else if (groupRow == i) {
+                    changedRows.append(groupRow);
                 }
             }
-            if (isRunning) {
-                // Hackery hacky time - if we end up running for longer than we're supposed to,
-                // assume that we missed something, and set ourselves available again.
-                // Also, we may end up in a situation where we have, in fact, been activated
-                // and deactivated correctly. In that case, let's not deactivate things we need
-                // to keep active. This could be done above, but keeping the code together feels
-                // simpler for future maintenance.
-                QTimer *timer = d->commandDeactivators[theCommand.command];
-                if (!timer) {
-                    timer = new QTimer(this);
-                    d->commandDeactivators[theCommand.command] = timer;
-                    timer->setSingleShot(true);
-                    timer->setInterval(theCommand.duration + theCommand.minimumCooldown);
-                    connect(timer, &QTimer::timeout, this, [this,&theCommand,timer]() {
-                        if (theCommand.isRunning) {
-                            qDebug() << "Automatically deactivating the following command - for some reason we seem to have missed the device ending the command." << theCommand.command;
-                            setRunning(theCommand.command, false);
-                        }
-                        d->commandDeactivators.remove(theCommand.command);
-                        timer->deleteLater();
-                    } );
+            static const QVector<int> changedRoles{TailCommandModel::IsRunning, TailCommandModel::IsAvailable};
+            int runStart{0};
+            for (int changed = 1; changed <= changedRows.count(); ++changed) {
+                if (changed == changedRows.count() || changedRows.at(changed) != changedRows.at(changed - 1) + 1) {
+                    dataChanged(index(changedRows.at(runStart), 0), index(changedRows.at(changed - 1), 0), changedRoles);
+                    runStart = changed;
                 }
-                timer->start();
             }
-            break;
+        }
+        if (isRunning) {
+            // Hackery hacky time - if we end up running for longer than we're supposed to,
+            // assume that we missed something, and set ourselves available again.
+            // Also, we may end up in a situation where we have, in fact, been activated
+            // and deactivated correctly. In that case, let's not deactivate things we need
+            // to keep active. This could be done above, but keeping the code together feels
+            // simpler for future maintenance.
+            TimerWheel* timerWheel = TimerWheel::getInstance();
+            timerWheel->cancel(d->commandDeactivators.value(commandId));
+            const QString commandName{theCommand.command};
+            d->commandDeactivators[commandId] = timerWheel->schedule(theCommand.duration + theCommand.minimumCooldown, this, [this,commandId,commandName]() {
+                d->commandDeactivators.remove(commandId);
+                const int row = d->idRows.value(commandId, -1);
+                if (row > -1 && d->rows.at(row).isRunning) {
+                    qDebug() << "Automatically deactivating the following command - for some reason we seem to have missed the device ending the command." << commandName;
+                    setRunning(commandId, false);
+                }
+            });
         }
     }
 //     qDebug() << "Done changing command running state";
 }
 
-const CommandInfoList& TailCommandModel::allCommands() const
+const CommandInfo& TailCommandModel::commandAt(int row) const
+{
+    return d->command(d->rows.at(row));
+}
+
+bool TailCommandModel::isRunningAt(int row) const
+{
+    return d->rows.at(row).isRunning;
+}
+
+bool TailCommandModel::isAvailableAt(int row) const
+{
+    return d->rows.at(row).isAvailable;
+}
+
+int TailCommandModel::commandRow(const QString& command) const
 {
-    return d->commands;
+    return d->rowOf(command);
+}
+
+int TailCommandModel::commandId(const QString& command) const
+{
+    return d->ids.value(command, -1);
+}
+
+QString TailCommandModel::commandForId(int commandId) const
+{
+    return d->idCommands.value(commandId);
+}
+
+int TailCommandModel::commandId(QLatin1String command) const
+{
+    // fromRawData doesn't copy, so this lookup doesn't allocate anything
+    return d->latin1Ids.value(QByteArray::fromRawData(command.data(), command.size()), -1);
 }
 
 bool TailCommandModel::isRunning(const CommandInfo& cmd) const
 {
-    bool retVal{false};
-    for (const CommandInfo& ourCmd : d->commands) {
-        if (cmd.compare(ourCmd)) {
-            retVal = ourCmd.isRunning;
-            break;
-        }
-    }
-    return retVal;
+    const int row = d->rowOf(cmd);
+    return row > -1 && d->rows.at(row).isRunning;
 }
 
 bool TailCommandModel::isAvailable(const CommandInfo& cmd) const
@@ -220,12 +382,8 @@ bool TailCommandModel::isAvailable(const CommandInfo& cmd) const
     if (cmd.command == "TAILHM") {
         retVal = true;
     } else {
-        for (const CommandInfo& ourCmd : d->commands) {
-            if (cmd.compare(ourCmd)) {
-                retVal = ourCmd.isAvailable;
-                break;
-            }
-        }
+        const int row = d->rowOf(cmd);
+        retVal = row > -1 && d->rows.at(row).isAvailable;
     }
     return retVal;
 }
@@ -57,6 +57,22 @@ public:
      * @param command The new command to show in the model
      */
     void addCommand(const CommandInfo& command);
+    /**
+     * Add all the commands in the list to the model, in the same rows as they would
+     * have ended up in if added one at a time with addCommand(CommandInfo), but as
+     * a single insertion, and with a single commandsAdded notification (rather than
+     * one commandAdded for each command).
+     * The list is held on to as it is, rather than copying each command out of it,
+     * so the commands can be shared with every other model that was given the same
+     * list (such as the lists held by CommandCatalogue).
+     * @param commands The new commands to show in the model
+     */
+    void addCommands(const CommandInfoList& commands);
+    /**
+     * Emitted when a list of commands is added using addCommands
+     * @param commands The list of commands which was added
+     */
+    Q_SIGNAL void commandsAdded(const CommandInfoList& commands);
     Q_SIGNAL void commandAdded(const CommandInfo& command);
     /**
      * Remove a command from the model.
@@ -73,14 +89,64 @@ public:
      * @param version The version for the tail we've been connected to
      */
     void autofill(const QString& version);
+    /**
+     * Mark the command with the given actual command as running or not running
+     * This is a convenience for setRunning(commandId(command), isRunning)
+     */
     void setRunning(const QString& command, bool isRunning);
+    /**
+     * Mark the command with the given id as running or not running, and update
+     * the availability of the other commands in its group to match. This emits
+     * dataChanged once for each run of neighbouring rows which changed.
+     * @param commandId The id of the command (see commandId())
+     * @param isRunning Whether the command is now running
+     */
+    void setRunning(int commandId, bool isRunning);
+    /**
+     * The id given to the actual command when it was added to this model. The ids
+     * are only valid for this model, and only until it is next cleared.
+     * @param command The actual command to look for
+     * @return The id of the command, or -1 if the command is not in this model
+     */
+    int commandId(const QString& command) const;
+    /**
+     * The id of the command, as for commandId(const QString&), but without the need
+     * to create a QString (and so without allocating anything).
+     */
+    int commandId(QLatin1String command) const;
+    /**
+     * The actual command which was given the id
+     * @param commandId The id of the command (see commandId())
+     * @return The actual command, or an empty string if the id is unknown
+     */
+    QString commandForId(int commandId) const;
 
     /**
-     * Get all the commands in this model
+     * Get the command in the given row of this model
      *
-     * @return A list of all commands currently managed by this model
+     * @note The running and available state of the command is not kept in the
+     * command itself (as it may be shared with other models), but is available
+     * through isRunningAt(int) and isAvailableAt(int)
+     * @param row A valid row in the model
+     * @return The command in the given row
+     */
+    const CommandInfo& commandAt(int row) const;
+    /**
+     * Whether the command in the given row of this model is marked as running
+     * @param row A valid row in the model
+     */
+    bool isRunningAt(int row) const;
+    /**
+     * Whether the command in the given row of this model is marked as being available
+     * @param row A valid row in the model
+     */
+    bool isAvailableAt(int row) const;
+    /**
+     * The row of the command with the given actual command in this model
+     * @param command The command to look for
+     * @return The row of the command, or -1 if the command is not in this model
      */
-    const CommandInfoList& allCommands() const;
+    int commandRow(const QString& command) const;
 
     /**
      * Whether the equivalent command to cmd in this model is marked as running
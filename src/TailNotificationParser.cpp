@@ -0,0 +1,148 @@
+/*
+ *   Copyright 2021 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#include "TailNotificationParser.h"
+
+#include <cstring>
+
+namespace {
+    const char beginKeyword[] = "BEGIN";
+    const int beginLength = 5;
+    const char endKeyword[] = "END";
+    const int endLength = 3;
+
+    bool isPrefixOf(const char* data, int length, const char* keyword, int keywordLength) {
+        return length <= keywordLength && memcmp(data, keyword, length) == 0;
+    }
+    bool endsWith(const char* data, int length, const char* keyword, int keywordLength) {
+        return length > keywordLength && memcmp(data + length - keywordLength, keyword, keywordLength) == 0;
+    }
+}
+
+TailNotificationParser::TailNotificationParser(Handler* handler)
+    : handler(handler)
+{
+}
+
+void TailNotificationParser::feed(const QByteArray& notification)
+{
+    const char* data = notification.constData();
+    const int length = notification.length();
+    for (int i = 0; i < length; ++i) {
+        if (state == KeywordState) {
+            keywordCharacter(data[i]);
+        } else {
+            nameCharacter(data[i]);
+        }
+    }
+    // If we stopped in the middle of a name, it may or may not continue in the next
+    // notification. A name which ends in a keyword is certainly waiting for the rest
+    // of that next event, but otherwise, if it's a command we know, it's complete.
+    if (state == NameState && nameLength > 0 && nameLength <= MaximumCommandLength && !nameOverflowed
+        && !endsWith(name, nameLength, beginKeyword, beginLength)
+        && !endsWith(name, nameLength, endKeyword, endLength)) {
+        const int commandId = handler->tailCommandId(QLatin1String(name, nameLength));
+        if (commandId > -1) {
+            handler->tailEvent(event, commandId);
+            reset();
+        }
+    }
+}
+
+void TailNotificationParser::reset()
+{
+    state = KeywordState;
+    keywordLength = 0;
+    nameLength = 0;
+    nameOverflowed = false;
+}
+
+void TailNotificationParser::keywordCharacter(char character)
+{
+    if (character == ' ') {
+        if (keywordLength == beginLength && isPrefixOf(keyword, keywordLength, beginKeyword, beginLength)) {
+            event = Begin;
+            state = NameState;
+        } else if (keywordLength == endLength && isPrefixOf(keyword, keywordLength, endKeyword, endLength)) {
+            event = End;
+            state = NameState;
+        }
+        keywordLength = 0;
+        return;
+    }
+    if (keywordLength < beginLength) {
+        keyword[keywordLength++] = character;
+        if (isPrefixOf(keyword, keywordLength, beginKeyword, beginLength) || isPrefixOf(keyword, keywordLength, endKeyword, endLength)) {
+            return;
+        }
+    }
+    // Not something we understand, so skip ahead until something which might be a keyword turns up
+    keywordLength = 0;
+    if (character == beginKeyword[0] || character == endKeyword[0]) {
+        keyword[keywordLength++] = character;
+    }
+}
+
+void TailNotificationParser::nameCharacter(char character)
+{
+    if (character <= ' ') {
+        if (character == ' ' && !nameOverflowed) {
+            // A squashed pair of events, where the keyword of the second event immediately
+            // follows the name of the first one, as in "END TAILS1BEGIN TAILHM"
+            Event nextEvent = event;
+            int keywordStart = -1;
+            if (endsWith(name, nameLength, beginKeyword, beginLength)) {
+                nextEvent = Begin;
+                keywordStart = nameLength - beginLength;
+            } else if (endsWith(name, nameLength, endKeyword, endLength)) {
+                nextEvent = End;
+                keywordStart = nameLength - endLength;
+            }
+            if (keywordStart > -1) {
+                report(keywordStart);
+                event = nextEvent;
+                nameLength = 0;
+                return;
+            }
+        }
+        finishName();
+        return;
+    }
+    if (nameLength < int(sizeof(name))) {
+        name[nameLength++] = character;
+    } else {
+        nameOverflowed = true;
+    }
+}
+
+void TailNotificationParser::finishName()
+{
+    if (!nameOverflowed) {
+        report(nameLength);
+    }
+    reset();
+}
+
+void TailNotificationParser::report(int length)
+{
+    if (length > 0 && length <= MaximumCommandLength) {
+        const int commandId = handler->tailCommandId(QLatin1String(name, length));
+        if (commandId > -1) {
+            handler->tailEvent(event, commandId);
+        }
+    }
+}
@@ -0,0 +1,100 @@
+/*
+ *   Copyright 2021 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#ifndef TAILNOTIFICATIONPARSER_H
+#define TAILNOTIFICATIONPARSER_H
+
+#include <QByteArray>
+#include <QLatin1String>
+
+/**
+ * An incremental tokenizer for the BEGIN and END notifications sent by the tail.
+ *
+ * The tail reports the start and end of a command as "BEGIN COMMAND" and "END COMMAND",
+ * but when two of those happen in quick succession, they arrive concatenated without
+ * any separator, and split over however many notifications it takes to fit them into
+ * the characteristic (for example "END TAILS1BEGIN TAIL" followed by "HM"). This parser
+ * is fed the raw notifications in the order they arrive, and reports each complete event
+ * to its handler, no matter how those events were fragmented or concatenated. Events are
+ * reported by the id of their command (as given by the handler), and events for names which
+ * are not known commands are dropped.
+ *
+ * The parser keeps its state in fixed size buffers, and does not allocate while parsing.
+ */
+class TailNotificationParser
+{
+public:
+    enum Event {
+        Begin,
+        End
+    };
+    /// The longest command name the parser will report (longer names are dropped)
+    static const int MaximumCommandLength = 32;
+
+    class Handler {
+    public:
+        virtual ~Handler() = default;
+        /**
+         * Called for each complete event in the stream which is for a known command.
+         * @param event Whether the command began or ended
+         * @param commandId The id of the command, as returned by tailCommandId()
+         */
+        virtual void tailEvent(Event event, int commandId) = 0;
+        /**
+         * Look up the id of a command name found in the stream.
+         *
+         * When a notification ends in the middle of a command name, there is no way to tell from the
+         * stream itself whether the name is complete, or continues in the next notification. If the
+         * name is a known command, the parser considers it complete, and reports it straight away.
+         * @param command The command name. This is only valid for the duration of the call.
+         * @return The id of the command, or -1 if it is not a known command
+         */
+        virtual int tailCommandId(QLatin1String command) const = 0;
+    };
+
+    explicit TailNotificationParser(Handler* handler);
+
+    /**
+     * Feed the next notification to the parser
+     * @param notification The notification exactly as received from the tail
+     */
+    void feed(const QByteArray& notification);
+    /**
+     * Forget any partially received event (for example when the connection to the tail is lost)
+     */
+    void reset();
+private:
+    void keywordCharacter(char character);
+    void nameCharacter(char character);
+    void finishName();
+    void report(int length);
+
+    Handler* handler;
+    enum State {
+        KeywordState,
+        NameState
+    };
+    State state{KeywordState};
+    Event event{Begin};
+    char keyword[5];
+    int keywordLength{0};
+    char name[MaximumCommandLength + 5];
+    int nameLength{0};
+    bool nameOverflowed{false};
+};
+
+#endif//TAILNOTIFICATIONPARSER_H
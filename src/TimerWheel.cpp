@@ -0,0 +1,225 @@
+/*
+ *   Copyright 2021 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#include "TimerWheel.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QPointer>
+#include <QTimer>
+#include <QVector>
+
+class TimerWheel::Private
+{
+public:
+    Private() {}
+    ~Private() {}
+
+    // Four levels of 64 slots each, which with 25ms ticks covers a little more than
+    // 116 hours before anything has to be put in the last slot and rescheduled.
+    static const int resolution{25};
+    static const int levels{4};
+    static const int slotBits{6};
+    static const int slotCount{1 << slotBits};
+    static const int slotMask{slotCount - 1};
+
+    struct Entry {
+        quint64 expiry{0}; // in ticks
+        QPointer<QObject> context;
+        std::function<void()> callback;
+    };
+    // The entries are kept here, and the slots only hold their handles, so cancelling
+    // is just removing the entry (and the handle is skipped when its slot comes up)
+    QHash<Handle, Entry> entries;
+    QVector<Handle> wheel[levels][slotCount];
+    Handle nextHandle{1};
+
+    QElapsedTimer clock;
+    quint64 currentTick{0};
+    // The timer is only ever set to go off on the tick when something next needs doing,
+    // rather than on every tick, so the wheel does not keep waking us up while it waits
+    QTimer timer;
+    quint64 wakeTick{0};
+
+    quint64 elapsedTicks() const
+    {
+        return quint64(clock.elapsed()) / resolution;
+    }
+
+    // Put the handle in the slot matching how far away its expiry is
+    void place(Handle handle, quint64 expiry)
+    {
+        const quint64 delta = expiry > currentTick ? expiry - currentTick : 0;
+        int level = 0;
+        while (level < levels - 1 && delta >= (quint64(1) << (slotBits * (level + 1)))) {
+            ++level;
+        }
+        if (level == levels - 1 && delta >= (quint64(1) << (slotBits * levels))) {
+            // Too far away for the wheel, so park it in the furthest slot, and
+            // reconsider it when that comes up (see tick())
+            expiry = currentTick + (quint64(1) << (slotBits * levels)) - 1;
+        }
+        wheel[level][(expiry >> (slotBits * level)) & slotMask] << handle;
+    }
+
+    void cascade(int level)
+    {
+        QVector<Handle> handles;
+        handles.swap(wheel[level][(currentTick >> (slotBits * level)) & slotMask]);
+        for (const Handle& handle : qAsConst(handles)) {
+            QHash<Handle, Entry>::const_iterator entry = entries.constFind(handle);
+            if (entry != entries.constEnd()) {
+                place(handle, entry.value().expiry);
+            }
+        }
+    }
+
+    void tick()
+    {
+        ++currentTick;
+        // When the lower levels wrap around, the slot coming up on the level above
+        // is spread out over the ones below, starting from the highest such level
+        int highest = 0;
+        while (highest < levels - 1 && (currentTick & ((quint64(1) << (slotBits * (highest + 1))) - 1)) == 0) {
+            ++highest;
+        }
+        for (int level = highest; level > 0; --level) {
+            cascade(level);
+        }
+
+        QVector<Handle> handles;
+        handles.swap(wheel[0][currentTick & slotMask]);
+        for (const Handle& handle : qAsConst(handles)) {
+            QHash<Handle, Entry>::iterator entry = entries.find(handle);
+            if (entry == entries.end()) {
+                continue;
+            }
+            if (entry.value().expiry > currentTick) {
+                // This was parked, because it was too far away to fit the wheel
+                place(handle, entry.value().expiry);
+                continue;
+            }
+            Entry theEntry = entry.value();
+            entries.erase(entry);
+            if (theEntry.context) {
+                theEntry.callback();
+            }
+        }
+    }
+
+    // The first tick on which a slot with something in it comes up, either to call the
+    // entries in it (on the lowest level), or to spread them out over the levels below.
+    // Slots may also hold cancelled entries, which at worst costs us a wasted wakeup.
+    quint64 nextOccupiedTick() const
+    {
+        quint64 next{0};
+        for (int level = 0; level < levels; ++level) {
+            const int shift = slotBits * level;
+            // The slots on each level come up on the ticks where the levels below wrap around
+            const quint64 first = ((currentTick >> shift) + 1) << shift;
+            for (int i = 0; i < slotCount; ++i) {
+                const quint64 slotTick = first + (quint64(i) << shift);
+                if (next > 0 && slotTick >= next) {
+                    break;
+                }
+                if (!wheel[level][(slotTick >> shift) & slotMask].isEmpty()) {
+                    next = slotTick;
+                    break;
+                }
+            }
+        }
+        return next;
+    }
+
+    void wakeAt(quint64 tick)
+    {
+        wakeTick = tick;
+        const qint64 remaining = qint64(tick * resolution) - clock.elapsed();
+        timer.start(int(qMax<qint64>(0, remaining)));
+    }
+
+    void advance()
+    {
+        const quint64 target = elapsedTicks();
+        while (currentTick < target && !entries.isEmpty()) {
+            tick();
+        }
+        if (entries.isEmpty()) {
+            // Nothing left to wait for, so there's no need to keep the wheel turning,
+            // and any handles left in the slots belong to cancelled entries
+            timer.stop();
+            for (int level = 0; level < levels; ++level) {
+                for (int slot = 0; slot < slotCount; ++slot) {
+                    wheel[level][slot].clear();
+                }
+            }
+            currentTick = target;
+        } else {
+            wakeAt(nextOccupiedTick());
+        }
+    }
+};
+
+TimerWheel::TimerWheel(QObject* parent)
+    : QObject(parent)
+    , d(new Private)
+{
+    d->clock.start();
+    d->timer.setSingleShot(true);
+    d->timer.setTimerType(Qt::CoarseTimer);
+    connect(&d->timer, &QTimer::timeout, this, [this](){ d->advance(); });
+}
+
+TimerWheel::~TimerWheel()
+{
+    delete d;
+}
+
+TimerWheel::Handle TimerWheel::schedule(int msec, QObject* context, std::function<void()> callback)
+{
+    if (d->entries.isEmpty()) {
+        // The wheel stands still while there's nothing in it, so catch up with the clock
+        d->currentTick = d->elapsedTicks();
+    }
+    const Handle handle = d->nextHandle++;
+    Private::Entry entry;
+    // Round up, so we never call anything early, and always at least one tick from now
+    entry.expiry = qMax((quint64(d->clock.elapsed()) + quint64(qMax(0, msec)) + Private::resolution - 1) / Private::resolution, d->currentTick + 1);
+    entry.context = context;
+    entry.callback = callback;
+    d->entries.insert(handle, entry);
+    d->place(handle, entry.expiry);
+    if (!d->timer.isActive() || entry.expiry < d->wakeTick) {
+        d->wakeAt(entry.expiry);
+    }
+    return handle;
+}
+
+void TimerWheel::cancel(Handle handle)
+{
+    d->entries.remove(handle);
+}
+
+bool TimerWheel::isScheduled(Handle handle) const
+{
+    return d->entries.contains(handle);
+}
+
+int TimerWheel::resolution() const
+{
+    return Private::resolution;
+}
@@ -0,0 +1,87 @@
+/*
+ *   Copyright 2021 Dan Leinir Turthra Jensen <admin@leinir.dk>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 3, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details
+ *
+ *   You should have received a copy of the GNU Library General Public License
+ *   along with this program; if not, see <https://www.gnu.org/licenses/>
+ */
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <QObject>
+
+#include <functional>
+
+/**
+ * A process-wide hierarchical timer wheel, for when lots of things need a timeout
+ * which rarely actually fires (such as the fallbacks which mark commands as no
+ * longer running, in case we missed the device telling us about it).
+ *
+ * However many callbacks are scheduled, the wheel uses one single timer, and
+ * scheduling and cancelling a callback are both constant time operations. The
+ * cost of that is precision: callbacks are called on the first tick of the wheel
+ * after their time has passed (see resolution()), never before. The timer is not
+ * set to go off on every tick, only when the next callback is due (or when the
+ * wheel needs to sort out the callbacks further away), so scheduling something a
+ * long way off does not keep waking the application up.
+ */
+class TimerWheel : public QObject
+{
+    Q_OBJECT
+public:
+    ~TimerWheel() override;
+
+    static TimerWheel* getInstance() {
+        static TimerWheel* instance = nullptr;
+        if(!instance) {
+            instance = new TimerWheel();
+        }
+        return instance;
+    }
+
+    /**
+     * Identifies a scheduled callback. Handles are never reused, and 0 is never a valid handle.
+     */
+    typedef quint64 Handle;
+
+    /**
+     * Schedule a callback to be called once, after the given amount of time
+     * @param msec The number of milliseconds to wait before calling the callback
+     * @param context If this object is deleted before the time has passed, the callback is not called
+     * @param callback The function to call
+     * @return A handle which can be used to cancel the callback
+     */
+    Handle schedule(int msec, QObject* context, std::function<void()> callback);
+    /**
+     * Cancel a scheduled callback. Cancelling a callback which has already been called
+     * (or cancelled) is safe, and does nothing.
+     * @param handle The handle returned when the callback was scheduled
+     */
+    void cancel(Handle handle);
+    /**
+     * Whether the callback is still waiting to be called
+     * @param handle The handle returned when the callback was scheduled
+     */
+    bool isScheduled(Handle handle) const;
+
+    /**
+     * The length of one tick of the wheel, in milliseconds
+     */
+    int resolution() const;
+private:
+    explicit TimerWheel(QObject* parent = nullptr);
+    class Private;
+    Private* d;
+};
+
+#endif//TIMERWHEEL_H
@@ -18,115 +18,128 @@
 #include "WalkingSensorGestureReconizer.h"
 
 #include <QAccelerometer>
+#include <QDebug>
 #include <QElapsedTimer>
-#include <QMutex>
 #include <QThread>
+#include <QTimer>
+
+#include "AccelerometerTrace.h"
+#include "StepDetector.h"
+
+namespace {
+    /**
+     * Everything to do with reading the accelerometer and finding steps in those readings
+     * lives in here, on the recognizer's worker thread. The only thing which goes back to
+     * the recognizer's own thread is the detected gestures.
+     */
+    class StepWorker : public QObject
+    {
+    public:
+        StepWorker(WalkingSensorGestureReconizer* recognizer)
+            : recognizer(recognizer)
+            , accelerometer(this)
+            , isWalkingTimer(this)
+        {
+            accelerometer.setDataRate(30);
+            accelerometer.setAccelerationMode(QAccelerometer::Combined);
+//             elapsedTimer.start();
+
+            isWalkingTimer.setInterval(4000);
+            isWalkingTimer.setSingleShot(true);
+            QObject::connect(&isWalkingTimer, &QTimer::timeout, this, [this] {
+                detected(QLatin1String("walkingStopped"));
+                stepCount = 0;
+            });
+
+            // The accelerometer lives on this same thread, so each reading goes straight into the step detection
+            QObject::connect(&accelerometer, &QAccelerometer::readingChanged, this, [this](){
+                const QAccelerometerReading* reading = accelerometer.reading();
+                processSample(AccelerometerTrace::Sample{reading->timestamp(), reading->z()});
+            });
+        }
+
+        void start()
+        {
+            // To record the readings for replaying later (see AccelerometerTrace), set
+            // DIGITAIL_ACCELEROMETER_TRACE to the name of the file to record them to
+            const QString traceFile = QString::fromLocal8Bit(qgetenv("DIGITAIL_ACCELEROMETER_TRACE"));
+            if (!traceFile.isEmpty() && !trace.isRecording()) {
+                trace.startRecording(traceFile);
+            }
+            accelerometer.setActive(true);
+            accelerometer.setAlwaysOn(true);
+        }
+
+        void stop()
+        {
+            accelerometer.setActive(false);
+            accelerometer.setAlwaysOn(false);
+            trace.stopRecording();
+        }
+
+        void processSample(const AccelerometerTrace::Sample& sample)
+        {
+            Q_ASSERT(QThread::currentThread() == thread());
+            // Q_EMIT zValueTick(sample.timestamp / 1000, sample.zValue - 9.8);
+            if (trace.isRecording()) {
+                trace.record(sample);
+            }
+            if (stepDetector.addSample(sample.timestamp, sample.zValue)) {
+                stepDetected();
+            }
+        }
+    private:
+        WalkingSensorGestureReconizer* recognizer;
+        QAccelerometer accelerometer;
+//         QElapsedTimer elapsedTimer;
+
+        AccelerometerTrace trace;
 
-#include <queue>
-#include <algorithm>
+        StepDetector stepDetector;
+        int stepCount{0};
+        QTimer isWalkingTimer;
 
-#define SAMPLE_SIZE (50)
+        void detected(const QString& gesture)
+        {
+            WalkingSensorGestureReconizer* target = recognizer;
+            QMetaObject::invokeMethod(target, [target, gesture](){ Q_EMIT target->detected(gesture); }, Qt::QueuedConnection);
+        }
 
-using ValueList = WalkingSensorGestureReconizer::ValueList;
+        void stepDetected()
+        {
+            stepCount += 1;
+            detected(QLatin1String("stepDetected"));
+            if (stepCount % 2) {
+                detected(QLatin1String("oddStepDetected"));
+            } else  {
+                detected(QLatin1String("evenStepDetected"));
+            }
+            if (!isWalkingTimer.isActive()) {
+                detected(QLatin1String("walkingStarted"));
+            }
+            isWalkingTimer.start();
+        }
+    };
+}
 
 class WalkingSensorGestureReconizer::Private {
 public:
     Private(WalkingSensorGestureReconizer* qq)
         : q(qq)
-        , zValue{9.8}
-        , workerThread(qq)
-        , stepCount{0}
+    {}
+    ~Private()
     {
-        accelerometer.setDataRate(30);
-        accelerometer.setAccelerationMode(QAccelerometer::Combined);
-//         elapsedTimer.start();
+        // The worker is deleted on its own thread, once that thread is finished
+        workerThread.quit();
+        workerThread.wait();
     }
     WalkingSensorGestureReconizer* q;
-    QTimer timer;
-    QAccelerometer accelerometer;
-    qreal zValue;
-//     QElapsedTimer elapsedTimer;
     QThread workerThread;
-    QMutex mutex;
-
-    int stepCount;
-    ValueList zVals;
-    QTimer isWalkingTimer;
-
-    void countSteps();
+    StepWorker* worker{nullptr};
+    // Whether we have asked the worker to be running (it gets around to it in its own time)
+    bool active{false};
 };
 
-static qreal median(const ValueList& input)
-{
-    auto sorted = input;
-    std::sort(sorted.begin(), sorted.end());
-    auto len = sorted.size();
-    auto index = (len - 1) / 2;
-    if (len % 2) {
-        return sorted[index];
-    } else {
-        return (sorted[index] + sorted[index + 1]) / static_cast<qreal>(2.0);
-    }
-}
-
-static std::vector<int> countZeros(const ValueList& deMeanedArray,
-                            const ValueList& filteredArray)
-{
-    size_t i = 0;
-    std::vector<int> zeroArray;
-    zeroArray.resize(deMeanedArray.size());
-    std::fill(zeroArray.begin(), zeroArray.end(), 0);
-
-    while (i < (filteredArray.size() - 30)) {
-        ValueList currentBuffer;
-        std::copy_n(deMeanedArray.begin() + i, std::min(static_cast<std::size_t>(30), deMeanedArray.size() - i),
-                    std::back_inserter(currentBuffer));
-//        qDebug() << i << filteredArray.size() - 30;
-        for (std::size_t bufferIndex = 0;
-             bufferIndex < currentBuffer.size() - 1;
-             ++bufferIndex) {
-            if ((currentBuffer[bufferIndex] < 0) && (currentBuffer[bufferIndex+1] > 0)) {
-                zeroArray[bufferIndex + i] = 1;
-//                qDebug() << "bufferIndex" << bufferIndex
-//                         << currentBuffer[bufferIndex] << currentBuffer[bufferIndex+1];
-            }
-        }
-
-        i += 15;
-    }
-    return zeroArray;
-}
-
-ValueList deMeanValues(const ValueList& filteredArray)
-{
-    ValueList deMeanedArray;
-    deMeanedArray.resize(filteredArray.size());
-    qreal filteredArrayMean = std::accumulate(filteredArray.begin(),
-                                              filteredArray.end(),
-                                              static_cast<qreal>(0))
-            / static_cast<qreal>(filteredArray.size());
-    for (std::size_t i = 0; i < filteredArray.size(); ++i) {
-        deMeanedArray[i] = filteredArray[i] - filteredArrayMean;
-    }
-    return deMeanedArray;
-}
-
-static ValueList medianFiltering(ValueList& zValues)
-{
-    ValueList filteredArray;
-    for (size_t i = 0; i < zValues.size(); ++i) {
-        zValues[i] = zValues[i] - 9.8; // gravity
-        if (i > 10) {
-            ValueList tmpBuff;
-            std::copy_n(zValues.begin() + i - 10, 10,
-                        std::back_inserter(tmpBuff));
-            filteredArray.push_back(median(tmpBuff));
-        }
-    }
-    return filteredArray;
-}
-
-
 WalkingSensorGestureReconizer::WalkingSensorGestureReconizer(QObject *parent)
     : QSensorGestureRecognizer(parent)
     , d(new Private(this))
@@ -140,100 +153,56 @@ WalkingSensorGestureReconizer::~WalkingSensorGestureReconizer()
 
 void WalkingSensorGestureReconizer::create()
 {
-    d->isWalkingTimer.setInterval(4000);
-    QObject::connect(&d->isWalkingTimer, &QTimer::timeout, [this] {
-       Q_EMIT detected("walkingStopped");
-       d->stepCount = 0;
-    });
-    d->isWalkingTimer.setSingleShot(true);
-
-    d->timer.moveToThread(&d->workerThread);
-    d->timer.setInterval(16);
-    d->timer.setSingleShot(false);
-    connect(&d->timer, &QTimer::timeout,this, [this](){
-        d->mutex.lock();
-        d->zVals.push_back(d->zValue);
-        d->mutex.unlock();
-        if ((d->zVals.size() % SAMPLE_SIZE == 0) && (d->zVals.size() >= SAMPLE_SIZE)) {
-            d->countSteps();
-        }
-        if (d->zVals.size() >= 5000) {
-            ValueList tmp(d->zVals.end() - 1000, d->zVals.end());
-            std::swap(d->zVals, tmp);
-        }
-
-        // Q_EMIT zValueTick(d->elapsedTimer.elapsed(), d->zValue - 9.8);
-    });
-
-    QObject::connect(&d->accelerometer, &QAccelerometer::readingChanged, this, [this](){
-        auto value = d->accelerometer.reading();
-        d->mutex.lock();
-        d->zValue = value->z();
-        d->mutex.unlock();
-    });
-
+    if (d->worker) {
+        return;
+    }
+    d->workerThread.setObjectName(QLatin1String("WalkingSensorGestureReconizer"));
+    d->worker = new StepWorker(this);
+    d->worker->moveToThread(&d->workerThread);
+    connect(&d->workerThread, &QThread::finished, d->worker, &QObject::deleteLater);
     d->workerThread.start();
 }
 
 bool WalkingSensorGestureReconizer::start()
 {
-    QMetaObject::invokeMethod(&d->timer, "start", Qt::QueuedConnection);
-
-    d->accelerometer.setActive(true);
-    d->accelerometer.setAlwaysOn(true);
-    return d->timer.isActive();
+    if (!d->worker) {
+        create();
+    }
+    StepWorker* worker = d->worker;
+    QMetaObject::invokeMethod(worker, [worker](){ worker->start(); }, Qt::QueuedConnection);
+    d->active = true;
+    return true;
 }
 
 bool WalkingSensorGestureReconizer::stop()
 {
-    QMetaObject::invokeMethod(&d->timer, "stop", Qt::QueuedConnection);
-    d->accelerometer.setActive(false);
-    d->accelerometer.setAlwaysOn(false);
+    if (d->worker) {
+        StepWorker* worker = d->worker;
+        QMetaObject::invokeMethod(worker, [worker](){ worker->stop(); }, Qt::QueuedConnection);
+    }
+    d->active = false;
     return true;
 }
 
-bool WalkingSensorGestureReconizer::isActive()
+void WalkingSensorGestureReconizer::replay(const QVector<AccelerometerTrace::Sample>& samples)
 {
-    return d->timer.isActive();
+    if (!d->worker) {
+        create();
+    }
+    StepWorker* worker = d->worker;
+    QMetaObject::invokeMethod(worker, [worker, &samples](){
+        for (const AccelerometerTrace::Sample& sample : samples) {
+            worker->processSample(sample);
+        }
+    }, Qt::BlockingQueuedConnection);
 }
 
-QString WalkingSensorGestureReconizer::id() const
+bool WalkingSensorGestureReconizer::isActive()
 {
-    return QString("QtSensors.Walking");
+    return d->active;
 }
 
-void WalkingSensorGestureReconizer::Private::countSteps()
+QString WalkingSensorGestureReconizer::id() const
 {
-    if (zVals.size() < SAMPLE_SIZE) {
-        return;
-    }
-    ValueList tmp(zVals.end() - SAMPLE_SIZE, zVals.end());
-//    qDebug() << QDateTime::currentDateTime() << QThread::currentThreadId();
-    auto filteredArray = medianFiltering(tmp);
-    auto deMeanedArray = deMeanValues(filteredArray);
-    auto zeroArray = countZeros(deMeanedArray, filteredArray);
-
-    for (std::size_t i = 0; i < zeroArray.size(); ++i) {
-        auto currentNumber = zeroArray[i];
-
-        if (currentNumber == 1) {
-            for (std::size_t j = i; j < i + 20; ++j) {
-                auto val = deMeanedArray[j];
-                if (val > 0.3) {
-                    stepCount += 1;
-                    Q_EMIT q->detected("stepDetected");
-                    if (stepCount % 2) {
-                        Q_EMIT q->detected("oddStepDetected");
-                    } else  {
-                        Q_EMIT q->detected("evenStepDetected");
-                    }
-                    if (!isWalkingTimer.isActive()) {
-                        Q_EMIT q->detected("walkingStarted");
-                    }
-                    isWalkingTimer.start();
-                    break;
-                }
-            }
-        }
-    }
+    return QString("QtSensors.Walking");
 }
@@ -19,14 +19,14 @@
 #define WALKINGSENSORGESTURERECONIZER_H
 
 #include <QSensorGestureRecognizer>
-#include <vector>
+
+#include "AccelerometerTrace.h"
 
 class WalkingSensorGestureReconizer : public QSensorGestureRecognizer
 {
     Q_OBJECT
 public:
     WalkingSensorGestureReconizer(QObject *parent = Q_NULLPTR);
-    using ValueList = std::vector<qreal>;
     void create() override;
 
     QString id() const override;
@@ -34,6 +34,16 @@ public:
     bool stop() override;
     bool isActive() override;
 
+    /**
+     * Feed recorded readings through the step detection, as though they had come from
+     * the accelerometer, and wait for the worker thread to get through all of them.
+     * As with the live readings, only the gestures found make their way back to this
+     * object's thread, and they are delivered through detected() once control returns
+     * to the event loop.
+     * @param samples The readings to feed through, oldest first
+     */
+    void replay(const QVector<AccelerometerTrace::Sample>& samples);
+
     ~WalkingSensorGestureReconizer();
 
 Q_SIGNALS:
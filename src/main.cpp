@@ -27,6 +27,7 @@
 #include <QtQml>
 #include <QUrl>
 #include <QColor>
+#include <QTextStream>
 #include <QTimer>
 #include <QIcon>
 
@@ -43,12 +44,14 @@
 #endif
 
 #include "../3rdparty/kirigami/src/kirigamiplugin.h"
+#include "AccelerometerTrace.h"
 #include "BTConnectionManager.h"
 #include "BTDeviceModel.h"
 #include "BTDeviceCommandModel.h"
 #include "FilterProxyModel.h"
 #include "AlarmList.h"
 #include "AppSettings.h"
+#include "CommandLatency.h"
 #include "CommandQueue.h"
 #include "GestureController.h"
 #include "GestureDetectorModel.h"
@@ -60,6 +63,7 @@
 #include "rep_SettingsProxy_replica.h"
 #include "rep_BTConnectionManagerProxy_replica.h"
 #include "rep_CommandQueueProxy_replica.h"
+#include "rep_CommandLatencyProxy_replica.h"
 #include <rep_GestureControllerProxy_replica.h>
 
 #include <klocalizedcontext.h>
@@ -141,6 +145,11 @@ int appMain(int argc, char *argv[])
     if(!res) { qCritical() << "Kapow! Replica for commandQueueReplica failed to surface"; }
     engine.rootContext()->setContextProperty(QLatin1String("CommandQueue"), commandQueueReplica.data());
 
+    QScopedPointer<CommandLatencyProxyReplica> commandLatencyReplica(repNode->acquire<CommandLatencyProxyReplica>());
+    res = commandLatencyReplica->waitForSource();
+    if(!res) { qCritical() << "Kapow! Replica for commandLatencyReplica failed to surface"; }
+    engine.rootContext()->setContextProperty(QLatin1String("CommandLatency"), commandLatencyReplica.data());
+
     QScopedPointer<GestureControllerProxyReplica> gestureControllerReplica(repNode->acquire<GestureControllerProxyReplica>());
     res = gestureControllerReplica->waitForSource();
     if(!res) { qCritical() << "Kapow! Replica for gestureControllerReplica failed to surface"; }
@@ -267,7 +276,7 @@ int serviceMain(int argc, char *argv[])
         BTDeviceModel* btDeviceModel = qobject_cast<BTDeviceModel*>(btConnectionManager->deviceModel());
         qDebug() << "Replicating device model";
         QVector<int> roles;
-        roles << BTDeviceModel::Name << BTDeviceModel::DeviceID << BTDeviceModel::DeviceVersion << BTDeviceModel::BatteryLevel << BTDeviceModel::CurrentCall << BTDeviceModel::IsConnected << BTDeviceModel::ActiveCommandTitles << BTDeviceModel::Checked << BTDeviceModel::HasListening << BTDeviceModel::ListeningState << BTDeviceModel::EnabledCommandsFiles << BTDeviceModel::MicsSwapped;
+        roles << BTDeviceModel::Name << BTDeviceModel::DeviceID << BTDeviceModel::DeviceVersion << BTDeviceModel::BatteryLevel << BTDeviceModel::CurrentCall << BTDeviceModel::IsConnected << BTDeviceModel::ActiveCommandTitles << BTDeviceModel::Checked << BTDeviceModel::HasListening << BTDeviceModel::ListeningState << BTDeviceModel::EnabledCommandsFiles << BTDeviceModel::MicsSwapped << BTDeviceModel::ReconnectState << BTDeviceModel::NextReconnectAttempt;
         srcNode.enableRemoting(btDeviceModel, "DeviceModel", roles);
 
         qDebug() << "Getting command model";
@@ -282,6 +291,9 @@ int serviceMain(int argc, char *argv[])
         qDebug() << "Replicating command queue";
         srcNode.enableRemoting(commandQueue);
 
+        qDebug() << "Replicating command latency statistics";
+        srcNode.enableRemoting(CommandLatency::getInstance());
+
         qDebug() << "Creating gesture controller";
         GestureController* gestureController = new GestureController(btConnectionManager);
         gestureController->setConnectionManager(btConnectionManager);
@@ -297,12 +309,41 @@ int serviceMain(int argc, char *argv[])
     return app.exec();
 }
 
+// Feed recorded accelerometer traces through the step detection, and report how well it did (see AccelerometerTrace).
+// Fails if the steps found in any trace which says how many steps were taken are more than 10% off.
+int replayWalkingMain(int argc, char *argv[])
+{
+    int result{0};
+    QTextStream out(stdout);
+    for (int i = 2; i < argc; ++i) {
+        const QString filename = QString::fromLocal8Bit(argv[i]);
+        const AccelerometerTrace::ReplayResult replay = AccelerometerTrace::replay(filename);
+        if (!replay.valid) {
+            out << filename << ": could not be read\n";
+            result = 1;
+            continue;
+        }
+        out << filename << ": " << replay.samples << " samples, " << replay.steps << " steps";
+        if (replay.expectedSteps > -1) {
+            const int difference = replay.steps - replay.expectedSteps;
+            out << " (expected " << replay.expectedSteps << ", " << (difference < 0 ? "" : "+") << difference << ")";
+            if (qAbs(difference) * 10 > replay.expectedSteps) {
+                result = 1;
+            }
+        }
+        out << ", " << QString::number(replay.nanosecondsPerSample, 'f', 1) << " ns per sample\n";
+    }
+    return result;
+}
+
 Q_DECL_EXPORT int main(int argc, char *argv[])
 {
     if (argc <= 1) {
         return appMain(argc, argv);
     } else if(argc > 1 && strcmp(argv[1], "-service") == 0) {
         return serviceMain(argc, argv);
+    } else if(argc > 2 && strcmp(argv[1], "-replay-walking") == 0) {
+        return replayWalkingMain(argc, argv);
     } else {
         // unrecognised argument
         return -1;
@@ -154,6 +154,20 @@ Kirigami.ScrollablePage {
             }
         }
 
+        SettingsCard {
+            headerText: i18nc("Heading for the panel for synchronising moves across devices, on the settings page", "Synchronised Moves");
+            descriptionText: i18nc("Description for the panel for synchronising moves across devices, on the settings page", "When sending a move to more than one piece of gear at the same time, some of them will usually start the move a little sooner than others. Enable this option to hold back the quicker gear a tiny bit, so that everything starts moving together.");
+            footer: QQC2.CheckBox {
+                text: i18nc("Label for the checkbox for synchronising moves across devices, on the settings page", "Synchronise moves across gear")
+                Layout.fillWidth: true
+                checked: AppSettings.synchronizedDispatch;
+
+                onClicked: {
+                    AppSettings.synchronizedDispatch = !AppSettings.synchronizedDispatch;
+                }
+            }
+        }
+
         SettingsCard {
             headerText: i18nc("Heading for the panel for the demo modus of the app, on the settings page","Fake Tail");
             descriptionText: i18nc("Description for the panel for the demo modus of the app, on the settings page", "If you have just downloaded the app, for example in anticipation of the arrival of your brand new, super shiny DIGITAiL or EarGear, you might want to explore what the app can do. You can click the button below to trick the app into thinking that there is a tail nearby, and let you explore what options exist. Enabling this option will make a fake tail show up on the welcome page.");